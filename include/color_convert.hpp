@@ -0,0 +1,381 @@
+#pragma once
+#include <immintrin.h>
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstdint>
+
+#include "colors.hpp"
+
+namespace f9ay {
+
+template <typename T>
+concept ycbcr_plane_type = std::same_as<T, int16_t> || std::same_as<T, uint8_t>;
+
+// JPEG (JFIF) 的 RGB -> YCbCr, 用 14 bit 定點數取代 roundf
+//   Y  = ( 4899 R + 9617 G + 1868 B) >> 14
+//   Cb = (-2765 R - 5427 G + 8192 B) >> 14 + 128
+//   Cr = ( 8192 R - 6860 G - 1332 B) >> 14 + 128
+// 結果會 clamp 到 [0, 255], AVX2 跟 scalar 的結果完全一樣
+class Ycbcr_convert {
+public:
+    static constexpr int fix_bits = 14;
+
+    // 把 n 個 pixel 轉成三個 plane
+    template <colors::color_type ColorType, ycbcr_plane_type T>
+    static void convert_row(const ColorType *src, int n, T *y, T *cb, T *cr) {
+        int i = 0;
+#ifdef __AVX2__
+        if constexpr (!std::same_as<ColorType, colors::YCbCr>) {
+            i = convert_avx2(src, n, y, cb, cr);
+        }
+#endif
+        convert_scalar(src + i, n - i, y + i, cb + i, cr + i);
+    }
+
+    // 灰階只需要 Y, 不計算 Cb Cr
+    template <colors::color_type ColorType, ycbcr_plane_type T>
+    static void convert_luma_row(const ColorType *src, int n, T *y) {
+        int i = 0;
+#ifdef __AVX2__
+        if constexpr (!std::same_as<ColorType, colors::YCbCr>) {
+            i = convert_avx2<ColorType, T, false>(src, n, y, nullptr, nullptr);
+        }
+#endif
+        convert_scalar<ColorType, T, false>(src + i, n - i, y + i, nullptr, nullptr);
+    }
+
+    // 降取樣用: Y 照常輸出, Cb Cr 每 h 個相鄰 pixel 相加成一個值, 寫進 (或 accumulate 時加到) cb cr
+    // 垂直方向的 v 列在 accumulate 時累加, 最後由呼叫端除以 h * v, 不需要全解析度的 Cb Cr
+    // n 以後到 padded_n 的部分當作 src[n - 1] 的複製, padded_n 必須是 h 的倍數
+    template <int h, colors::color_type ColorType>
+    static void convert_row_down_sampled(const ColorType *src, int n, int padded_n, int16_t *y, int16_t *cb,
+                                         int16_t *cr, bool accumulate) {
+        int i = 0;
+#ifdef __AVX2__
+        if constexpr (!std::same_as<ColorType, colors::YCbCr>) {
+            // 至少留一個 pixel 給 scalar 複製邊緣
+            i = convert_down_sampled_avx2<h>(src, n - 1, y, cb, cr, accumulate);
+        }
+#endif
+        for (; i < padded_n; i += h) {
+            int cb_sum = 0, cr_sum = 0;
+            for (int k = i; k < i + h; k++) {
+                int16_t cb_value, cr_value;
+                convert_scalar(src + std::min(k, n - 1), 1, y + k, &cb_value, &cr_value);
+                cb_sum += cb_value;
+                cr_sum += cr_value;
+            }
+            cb[i / h] = static_cast<int16_t>(cb_sum + (accumulate ? cb[i / h] : 0));
+            cr[i / h] = static_cast<int16_t>(cr_sum + (accumulate ? cr[i / h] : 0));
+        }
+    }
+
+    // with_chroma = false 時 cb cr 不會被寫入, 可以是 nullptr
+    template <colors::color_type ColorType, ycbcr_plane_type T, bool with_chroma = true>
+    static void convert_scalar(const ColorType *src, int n, T *y, T *cb, T *cr) {
+        for (int i = 0; i < n; i++) {
+            if constexpr (std::same_as<ColorType, colors::YCbCr>) {
+                y[i] = static_cast<T>(src[i].y);
+                if constexpr (with_chroma) {
+                    cb[i] = static_cast<T>(src[i].cb);
+                    cr[i] = static_cast<T>(src[i].cr);
+                }
+            } else {
+                const int r = src[i].r;
+                const int g = src[i].g;
+                const int b = src[i].b;
+                y[i] = static_cast<T>(descale(y_r * r + y_g * g + y_b * b, 0));
+                if constexpr (with_chroma) {
+                    cb[i] = static_cast<T>(descale(cb_r * r + cb_g * g + cb_b * b, 128));
+                    cr[i] = static_cast<T>(descale(cr_r * r + cr_g * g + cr_b * b, 128));
+                }
+            }
+        }
+    }
+
+#ifdef __AVX2__
+    // 一次 16 個 pixel, 回傳處理了幾個, 剩下的交給 scalar
+    template <colors::color_type ColorType, ycbcr_plane_type T, bool with_chroma = true>
+    static int convert_avx2(const ColorType *src, int n, T *y, T *cb, T *cr) {
+        constexpr int size = sizeof(ColorType);
+        const auto *bytes = reinterpret_cast<const uint8_t *>(src);
+        const auto rg_mask = load_mask(shuffle_mask<ColorType>(true));
+        const auto b_mask = load_mask(shuffle_mask<ColorType>(false));
+
+        int i = 0;
+        for (; (i + 16) * size + over_read<ColorType> <= n * size; i += 16) {
+            __m256i y_out[2], cb_out[2], cr_out[2];
+            convert_16<ColorType, with_chroma>(bytes + i * size, rg_mask, b_mask, y_out, cb_out, cr_out);
+            store_16(y + i, y_out);
+            if constexpr (with_chroma) {
+                store_16(cb + i, cb_out);
+                store_16(cr + i, cr_out);
+            }
+        }
+        return i;
+    }
+
+    // convert_row_down_sampled 的 AVX2 版本, 回傳處理了幾個 pixel
+    template <int h, colors::color_type ColorType>
+    static int convert_down_sampled_avx2(const ColorType *src, int n, int16_t *y, int16_t *cb, int16_t *cr,
+                                         bool accumulate) {
+        static_assert(h == 1 || h == 2);
+        constexpr int size = sizeof(ColorType);
+        const auto *bytes = reinterpret_cast<const uint8_t *>(src);
+        const auto rg_mask = load_mask(shuffle_mask<ColorType>(true));
+        const auto b_mask = load_mask(shuffle_mask<ColorType>(false));
+
+        int i = 0;
+        for (; (i + 16) * size + over_read<ColorType> <= n * size; i += 16) {
+            __m256i y_out[2], cb_out[2], cr_out[2];
+            convert_16<ColorType, true>(bytes + i * size, rg_mask, b_mask, y_out, cb_out, cr_out);
+            store_16(y + i, y_out);
+            sum_chroma<h>(cb + i / h, cb_out, accumulate);
+            sum_chroma<h>(cr + i / h, cr_out, accumulate);
+        }
+        return i;
+    }
+#endif
+
+private:
+    static constexpr int y_r = 4899, y_g = 9617, y_b = 1868;
+    static constexpr int cb_r = -2765, cb_g = -5427, cb_b = 8192;
+    static constexpr int cr_r = 8192, cr_g = -6860, cr_b = -1332;
+
+    static int descale(int sum, int offset) {
+        return std::clamp(((sum + (1 << (fix_bits - 1))) >> fix_bits) + offset, 0, 255);
+    }
+
+#ifdef __AVX2__
+    // 3 byte 的 pixel 每次讀 16 byte 只用到 12 byte, 最後會多讀 4 byte
+    template <colors::color_type ColorType>
+    static constexpr int over_read = sizeof(ColorType) == 3 ? 4 : 0;
+
+    // 轉換 16 個 pixel, 每個輸出是兩組 8 個 int32
+    template <colors::color_type ColorType, bool with_chroma>
+    static void convert_16(const uint8_t *bytes, __m256i rg_mask, __m256i b_mask, __m256i (&y_out)[2],
+                           __m256i (&cb_out)[2], __m256i (&cr_out)[2]) {
+        for (int half = 0; half < 2; half++) {
+            const auto pixels = load_8_pixels<sizeof(ColorType)>(bytes + half * 8 * sizeof(ColorType));
+            // 每個 32 bit lane 是一個 pixel: rg = [r, g] 兩個 16 bit, b = [b, 0]
+            const auto rg = _mm256_shuffle_epi8(pixels, rg_mask);
+            const auto b = _mm256_shuffle_epi8(pixels, b_mask);
+            y_out[half] = channel(rg, b, y_r, y_g, y_b, 0);
+            if constexpr (with_chroma) {
+                cb_out[half] = channel(rg, b, cb_r, cb_g, cb_b, 128);
+                cr_out[half] = channel(rg, b, cr_r, cr_g, cr_b, 128);
+            }
+        }
+    }
+
+    template <colors::color_type ColorType>
+    static constexpr int byte_offset(char channel) {
+        if constexpr (std::same_as<ColorType, colors::RGB> || std::same_as<ColorType, colors::RGBA>) {
+            return channel == 'r' ? 0 : channel == 'g' ? 1 : 2;
+        } else {
+            return channel == 'r' ? 2 : channel == 'g' ? 1 : 0;
+        }
+    }
+
+    // 每個 128 bit lane 有 4 個 pixel, 把 (r, g) 或 (b) 搬到每個 32 bit lane 的 16 bit word, 其餘補 0
+    template <colors::color_type ColorType>
+    static const std::array<int8_t, 32> &shuffle_mask(bool rg) {
+        constexpr auto make = [](bool rg) {
+            constexpr int size = sizeof(ColorType);
+            std::array<int8_t, 32> mask{};
+            for (int lane = 0; lane < 2; lane++) {
+                for (int k = 0; k < 4; k++) {
+                    auto *m = &mask[lane * 16 + k * 4];
+                    m[0] = static_cast<int8_t>(size * k + byte_offset<ColorType>(rg ? 'r' : 'b'));
+                    m[1] = -128;
+                    m[2] = rg ? static_cast<int8_t>(size * k + byte_offset<ColorType>('g')) : -128;
+                    m[3] = -128;
+                }
+            }
+            return mask;
+        };
+        alignas(32) static constexpr auto rg_mask = make(true);
+        alignas(32) static constexpr auto b_mask = make(false);
+        return rg ? rg_mask : b_mask;
+    }
+
+    static __m256i load_mask(const std::array<int8_t, 32> &mask) {
+        return _mm256_load_si256(reinterpret_cast<const __m256i *>(mask.data()));
+    }
+
+    // 讀 8 個 pixel, 前 4 個放在低 128 bit, 後 4 個放在高 128 bit
+    template <int size>
+    static __m256i load_8_pixels(const uint8_t *p) {
+        if constexpr (size == 4) {
+            return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        } else {
+            const auto lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            const auto hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 4 * size));
+            return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        }
+    }
+
+    static __m256i word_pair(int lo, int hi) {
+        const auto packed =
+            static_cast<uint32_t>(static_cast<uint16_t>(lo)) | static_cast<uint32_t>(static_cast<uint16_t>(hi)) << 16;
+        return _mm256_set1_epi32(static_cast<int>(packed));
+    }
+
+    static __m256i channel(__m256i rg, __m256i b, int cr, int cg, int cb, int offset) {
+        auto sum =
+            _mm256_add_epi32(_mm256_madd_epi16(rg, word_pair(cr, cg)), _mm256_madd_epi16(b, word_pair(cb, 0)));
+        sum = _mm256_add_epi32(sum, _mm256_set1_epi32((offset << fix_bits) + (1 << (fix_bits - 1))));
+        sum = _mm256_srai_epi32(sum, fix_bits);
+        return _mm256_max_epi32(_mm256_min_epi32(sum, _mm256_set1_epi32(255)), _mm256_setzero_si256());
+    }
+
+    // 兩組 8 個 int32 依序壓成 16 個 int16
+    static __m256i pack_16(const __m256i (&v)[2]) {
+        // packs 是以 128 bit lane 為單位交錯的, 需要 permute 回原本的順序
+        return _mm256_permute4x64_epi64(_mm256_packs_epi32(v[0], v[1]), _MM_SHUFFLE(3, 1, 2, 0));
+    }
+
+    // 16 個 Cb 或 Cr 每 h 個相加後寫入 (或加到) dst
+    template <int h>
+    static void sum_chroma(int16_t *dst, const __m256i (&v)[2], bool accumulate) {
+        if constexpr (h == 1) {
+            auto words = pack_16(v);
+            if (accumulate) {
+                words = _mm256_add_epi16(words, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst)));
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), words);
+        } else {
+            // hadd 也是以 128 bit lane 為單位, permute 後是依序 8 個相鄰 pixel 的和
+            const auto sums = _mm256_permute4x64_epi64(_mm256_hadd_epi32(v[0], v[1]), _MM_SHUFFLE(3, 1, 2, 0));
+            auto words = _mm_packs_epi32(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+            if (accumulate) {
+                words = _mm_add_epi16(words, _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst)));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), words);
+        }
+    }
+
+    // 兩組 8 個 int32 壓成 16 個輸出
+    template <ycbcr_plane_type T>
+    static void store_16(T *dst, const __m256i (&v)[2]) {
+        const auto words = pack_16(v);
+        if constexpr (std::same_as<T, int16_t>) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), words);
+        } else {
+            const auto bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm256_castsi256_si128(bytes));
+        }
+    }
+#endif
+};
+
+// 解碼用的 YCbCr -> BGR (JFIF), Cb' = Cb - 128, Cr' = Cr - 128
+//   R = Y + Cr' + m(Cr', 13173)
+//   G = Y - m(Cb', 11277) - m(Cr', 23401)
+//   B = Y + Cb' + m(Cb', 25297)
+// m(x, c) = (x * c + 2^14) >> 15 跟 _mm256_mulhrs_epi16 一樣, 結果 clamp 到 [0, 255], AVX2 跟 scalar 完全一樣
+class Ycbcr_to_bgr {
+public:
+    // chroma_shift = 1 時 cb cr 只有一半的寬度, 每個值給相鄰兩個 pixel, 水平升頻跟轉換一起做
+    static void convert_row(const uint8_t *y, const uint8_t *cb, const uint8_t *cr, int n, int chroma_shift,
+                            colors::BGR *dst) {
+        int i = 0;
+#ifdef __AVX2__
+        i = convert_avx2(y, cb, cr, n, chroma_shift, dst);
+#endif
+        for (; i < n; i++) {
+            const int luma = y[i];
+            const int cb_ = cb[i >> chroma_shift] - 128;
+            const int cr_ = cr[i >> chroma_shift] - 128;
+            dst[i].r = clamp(luma + cr_ + mul(cr_, r_cr));
+            dst[i].g = clamp(luma - mul(cb_, g_cb) - mul(cr_, g_cr));
+            dst[i].b = clamp(luma + cb_ + mul(cb_, b_cb));
+        }
+    }
+
+#ifdef __AVX2__
+    // 一次 16 個 pixel, 回傳處理了幾個
+    static int convert_avx2(const uint8_t *y, const uint8_t *cb, const uint8_t *cr, int n, int chroma_shift,
+                            colors::BGR *dst) {
+        const auto offset = _mm256_set1_epi16(128);
+        auto *out = reinterpret_cast<uint8_t *>(dst);
+        int i = 0;
+        for (; i + 16 <= n; i += 16) {
+            const auto luma = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(y + i)));
+            const auto cb_ = _mm256_sub_epi16(load_chroma(cb + (i >> chroma_shift), chroma_shift), offset);
+            const auto cr_ = _mm256_sub_epi16(load_chroma(cr + (i >> chroma_shift), chroma_shift), offset);
+
+            const auto r = _mm256_add_epi16(_mm256_add_epi16(luma, cr_), _mm256_mulhrs_epi16(cr_, splat(r_cr)));
+            const auto g = _mm256_sub_epi16(_mm256_sub_epi16(luma, _mm256_mulhrs_epi16(cb_, splat(g_cb))),
+                                            _mm256_mulhrs_epi16(cr_, splat(g_cr)));
+            const auto b = _mm256_add_epi16(_mm256_add_epi16(luma, cb_), _mm256_mulhrs_epi16(cb_, splat(b_cb)));
+            store_bgr(out + i * 3, to_bytes(b), to_bytes(g), to_bytes(r));
+        }
+        return i;
+    }
+#endif
+
+private:
+    static constexpr int r_cr = 13173;  // 0.402 * 2^15
+    static constexpr int g_cb = 11277;  // 0.344136 * 2^15
+    static constexpr int g_cr = 23401;  // 0.714136 * 2^15
+    static constexpr int b_cb = 25297;  // 0.772 * 2^15
+
+    static int mul(int x, int c) {
+        return (x * c + (1 << 14)) >> 15;
+    }
+
+    static uint8_t clamp(int x) {
+        return static_cast<uint8_t>(std::clamp(x, 0, 255));
+    }
+
+#ifdef __AVX2__
+    static __m256i splat(int c) {
+        return _mm256_set1_epi16(static_cast<int16_t>(c));
+    }
+
+    // 16 個 chroma, chroma_shift = 1 時只讀 8 個, 每個複製兩次
+    static __m256i load_chroma(const uint8_t *p, int chroma_shift) {
+        if (chroma_shift == 0) {
+            return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+        }
+        const auto half = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+        return _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(half, half));
+    }
+
+    // 16 個 int16 飽和成 16 個 byte
+    static __m128i to_bytes(__m256i v) {
+        const auto packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), _MM_SHUFFLE(3, 1, 2, 0));
+        return _mm256_castsi256_si128(packed);
+    }
+
+    // 三個 plane 各 16 byte 交錯成 48 byte 的 BGR, 每 16 byte 的輸出由三個 pshufb OR 起來
+    static void store_bgr(uint8_t *out, __m128i b, __m128i g, __m128i r) {
+        constexpr auto make = [](int chunk, int channel) {
+            std::array<int8_t, 16> mask{};
+            for (int k = 0; k < 16; k++) {
+                const int index = chunk * 16 + k;
+                mask[k] = index % 3 == channel ? static_cast<int8_t>(index / 3) : -128;
+            }
+            return mask;
+        };
+        alignas(16) static constexpr std::array<std::array<int8_t, 16>, 9> masks = {
+            make(0, 0), make(0, 1), make(0, 2), make(1, 0), make(1, 1), make(1, 2), make(2, 0), make(2, 1), make(2, 2),
+        };
+        // 每個 mask 各自載入, 不跨過 std::array 的邊界
+        const auto load = [](const std::array<int8_t, 16> &mask) {
+            return _mm_load_si128(reinterpret_cast<const __m128i *>(mask.data()));
+        };
+        for (int chunk = 0; chunk < 3; chunk++) {
+            const auto bytes = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, load(masks[chunk * 3])),
+                                                         _mm_shuffle_epi8(g, load(masks[chunk * 3 + 1]))),
+                                            _mm_shuffle_epi8(r, load(masks[chunk * 3 + 2])));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + chunk * 16), bytes);
+        }
+    }
+#endif
+};
+
+}  // namespace f9ay
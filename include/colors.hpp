@@ -1,5 +1,7 @@
 #pragma once
 #include <cstddef>
+#include <cstdint>
+#include <format>
 #include <iostream>
 #include <tuple>
 
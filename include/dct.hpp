@@ -4,8 +4,13 @@
 #include <immintrin.h>
 #endif
 
+#include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <numbers>
+#include <type_traits>
 
 #include "matrix.hpp"
 #include "matrix_concept.hpp"
@@ -13,6 +18,48 @@
 
 namespace f9ay {
 
+#ifdef __AVX__
+// 8x8 轉置, 全部在暫存器裡完成
+inline void transpose_8x8(__m256 (&r)[8]) {
+    const auto t0 = _mm256_unpacklo_ps(r[0], r[1]);
+    const auto t1 = _mm256_unpackhi_ps(r[0], r[1]);
+    const auto t2 = _mm256_unpacklo_ps(r[2], r[3]);
+    const auto t3 = _mm256_unpackhi_ps(r[2], r[3]);
+    const auto t4 = _mm256_unpacklo_ps(r[4], r[5]);
+    const auto t5 = _mm256_unpackhi_ps(r[4], r[5]);
+    const auto t6 = _mm256_unpacklo_ps(r[6], r[7]);
+    const auto t7 = _mm256_unpackhi_ps(r[6], r[7]);
+    const auto s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    const auto s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    const auto s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    const auto s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    const auto s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+    const auto s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    const auto s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+    const auto s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+    r[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+    r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+    r[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+    r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+    r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+    r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+    r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+    r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+// 整數版本只是把位元當成 float 搬動
+inline void transpose_8x8(__m256i (&r)[8]) {
+    __m256 f[8];
+    for (int i = 0; i < 8; i++) {
+        f[i] = _mm256_castsi256_ps(r[i]);
+    }
+    transpose_8x8(f);
+    for (int i = 0; i < 8; i++) {
+        r[i] = _mm256_castps_si256(f[i]);
+    }
+}
+#endif
+
 template <int N>
 class Dct_old {
     using fl_t = float;
@@ -42,7 +89,7 @@ public:
 
 private:
     static constexpr auto normalize_constant(const int u) {
-        if (u != 1) {
+        if (u == 0) {
             return 1 / sqrt(2);
         } else {
             return 1.;
@@ -60,23 +107,36 @@ public:
         if (matrix.row() != N || matrix.col() != N) [[unlikely]] {
             throw std::invalid_argument("matrix size not match");
         }
-        Matrix<fl_t> row_dct(N, N);
+        std::array<fl_t, N * N> block;
+        std::copy(matrix.raw(), matrix.raw() + N * N, block.begin());
+        dct(block);
+        Matrix<OUT> result(N, N);
+        std::copy(block.begin(), block.end(), result.raw());
+        return result;
+    }
+
+    // row-major 的 N*N block, 原地轉換並四捨五入, 不配置任何 heap 記憶體
+    template <typename T>
+    static void dct(std::array<T, N * N> &block) {
+        std::array<fl_t, N * N> row_dct;
         for (int i = 0; i < N; i++) {
-            dct_1d<IN, fl_t>(&matrix[i, 0], &row_dct[i, 0]);
+            dct_1d<T, fl_t>(&block[i * N], &row_dct[i * N]);
         }
-        auto row_trp = row_dct.transpose();
-        Matrix<fl_t> col_dct(N, N);
+        std::array<fl_t, N * N> row_trp;
         for (int i = 0; i < N; i++) {
-            dct_1d<fl_t, fl_t>(&row_trp[i, 0], &col_dct[i, 0]);
+            for (int j = 0; j < N; j++) {
+                row_trp[j * N + i] = row_dct[i * N + j];
+            }
+        }
+        std::array<fl_t, N * N> col_dct;
+        for (int i = 0; i < N; i++) {
+            dct_1d<fl_t, fl_t>(&row_trp[i * N], &col_dct[i * N]);
         }
-        // auto col_trp = col_dct.transpose();
-        Matrix<OUT> result(N, N);
         for (int i = 0; i < N; i++) {
             for (int j = 0; j < N; j++) {
-                result[i, j] = std::round(col_dct[j, i]);
+                block[i * N + j] = std::round(col_dct[j * N + i]);
             }
         }
-        return result;
     }
 
 private:
@@ -106,51 +166,71 @@ class Dct<8> {
 public:
     template <typename IN, typename OUT>
     static auto dct(const Matrix<IN> &matrix) {
-        Matrix<fl_t> mat_fl(N, N);
-        for (int i = 0; i < 64; i++) {
-            mat_fl.raw()[i] = matrix.raw()[i];
-        }
-        Matrix<fl_t> row_dct(N, N);
+        std::array<fl_t, N * N> block;
+        std::copy(matrix.raw(), matrix.raw() + N * N, block.begin());
+        dct(block);
+        Matrix<OUT> result(N, N);
+        std::copy(block.begin(), block.end(), result.raw());
+        return result;
+    }
+
+    // row-major 的 8x8 block, 原地轉換並四捨五入
+    // 每列放在一個 YMM 裡, 兩個 pass 都是 broadcast 係數乘整個暫存器再相加, 不需要 horizontal sum
+    // 中間的轉置也在暫存器裡完成
+    template <typename T>
+    static void dct(std::array<T, N * N> &block) {
+        __m256 r[N];
         for (int i = 0; i < N; i++) {
-            dct_1d(&mat_fl[i, 0], &row_dct[i, 0]);
+            r[i] = load_row(&block[i * N]);
         }
-        auto row_trp = row_dct.transpose();
-        Matrix<fl_t> col_dct(N, N);
+        dct_columns(r);
+        transpose_8x8(r);
+        dct_columns(r);
+        transpose_8x8(r);
         for (int i = 0; i < N; i++) {
-            dct_1d(&row_trp[i, 0], &col_dct[i, 0]);
+            store_row(&block[i * N], r[i]);
         }
-        // auto col_trp = col_dct.transpose();
-        Matrix<OUT> result(N, N);
-        for (int i = 0; i < N; i++) {
-            for (int j = 0; j < N; j++) {
-                result[i, j] = std::round(col_dct[j, i]);
+    }
+
+private:
+    // r[u] = sum(coeff[u][n] * r[n]), 每個 lane 各自做一行的 1-D DCT
+    static void dct_columns(__m256 (&r)[N]) {
+        __m256 out[N];
+        for (int u = 0; u < N; u++) {
+            auto sum = _mm256_mul_ps(_mm256_broadcast_ss(&coeff[u][0]), r[0]);
+            for (int n = 1; n < N; n++) {
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_broadcast_ss(&coeff[u][n]), r[n]));
             }
+            out[u] = sum;
+        }
+        for (int u = 0; u < N; u++) {
+            r[u] = out[u];
         }
-        return result;
     }
 
-    static void dct_1d(const float *s_arr, float *out) {
-        auto s = _mm256_loadu_ps(s_arr);
-        for (int k = 0; k < N; ++k) {
-            auto coeff_line = _mm256_loadu_ps(&coeff[k][0]);
-            auto r = _mm256_mul_ps(s, coeff_line);
-            out[k] = fast_horizontal_sum(r);
+    template <typename T>
+    static __m256 load_row(const T *src) {
+        if constexpr (std::is_floating_point_v<T>) {
+            static_assert(sizeof(T) == 4);
+            return _mm256_loadu_ps(src);
+        } else {
+            static_assert(sizeof(T) == 4);
+            return _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src)));
         }
     }
 
-    static float fast_horizontal_sum(__m256 v) {
-        __m128 vlow = _mm256_castps256_ps128(v);
-        __m128 vhigh = _mm256_extractf128_ps(v, 1);
-        __m128 sum128 = _mm_add_ps(vlow, vhigh);
-
-        __m128 shuf = _mm_movehdup_ps(sum128);
-        __m128 sums = _mm_add_ps(sum128, shuf);
-        shuf = _mm_movehl_ps(shuf, sums);
-        sums = _mm_add_ss(sums, shuf);
-        return _mm_cvtss_f32(sums);
+    // 跟 std::round 一樣 0.5 遠離 0
+    template <typename T>
+    static void store_row(T *dst, __m256 v) {
+        const auto half = _mm256_or_ps(_mm256_and_ps(v, _mm256_set1_ps(-0.0f)), _mm256_set1_ps(0.5f));
+        const auto rounded = _mm256_round_ps(_mm256_add_ps(v, half), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        if constexpr (std::is_floating_point_v<T>) {
+            _mm256_storeu_ps(dst, rounded);
+        } else {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_cvttps_epi32(rounded));
+        }
     }
 
-private:
     /* clang-format off */
     static constexpr float coeff[8][8] = {
         {0.3535533905932738, 0.3535533905932738, 0.3535533905932738, 0.3535533905932738, 0.3535533905932738, 0.3535533905932738, 0.3535533905932738, 0.3535533905932738 },
@@ -166,4 +246,432 @@ private:
 };
 #endif
 
+// AAN (Arai, Agui, Nakajima) 快速整數 DCT, 每個 1-D pass 只要 5 個乘法
+// 輸出少乘了每個頻率的縮放:
+//   out[u][v] = F(u, v) * scale[u] * scale[v] * (1 << output_bits)
+// 這個縮放要折進量化表 (fixed_scale), 不在 DCT 裡面做
+class Dct_aan {
+    static constexpr int N = 8;
+
+public:
+    static constexpr int const_bits = 13;  // 乘法常數的定點小數位數
+    static constexpr int pass1_bits = 3;   // 第一個 pass 多保留的精度
+    static constexpr int output_bits = 4;  // 輸出相對 F(u, v) 放大 16 倍
+
+    // scale[0] = 1, scale[k] = cos(k * pi / 16) * sqrt(2)
+    static constexpr std::array<double, N> scale = {1.0,         1.387039845, 1.306562965, 1.175875602,
+                                                    1.0,         0.785694958, 0.541196100, 0.275899379};
+
+    static constexpr int scale_bits = 20;
+
+    // scale[u] * scale[v] * (1 << output_bits) 的 scale_bits 位定點數
+    // 在編譯期算好, 量化表只用整數把它折進去, 不受執行時浮點設定影響
+    static constexpr std::array<int64_t, N * N> fixed_scale = [] {
+        std::array<int64_t, N * N> result{};
+        for (int i = 0; i < N; i++) {
+            for (int j = 0; j < N; j++) {
+                result[i * N + j] =
+                    static_cast<int64_t>(scale[i] * scale[j] * (1 << output_bits) * (1 << scale_bits) + 0.5);
+            }
+        }
+        return result;
+    }();
+
+    // row-major 的 8x8 block, 原地轉換
+    template <typename T>
+    static void dct(std::array<T, N * N> &block) {
+#ifdef __AVX2__
+        dct_avx2(block);
+#else
+        dct_scalar(block);
+#endif
+    }
+
+    template <typename T>
+    static void dct_scalar(std::array<T, N * N> &block) {
+        int32_t tmp[N * N];
+        for (int i = 0; i < N; i++) {
+            int32_t d[N];
+            for (int j = 0; j < N; j++) {
+                d[j] = static_cast<int32_t>(block[i * N + j]) << pass1_bits;
+            }
+            butterfly(d, scalar_ops{});
+            for (int j = 0; j < N; j++) {
+                tmp[i * N + j] = d[j];
+            }
+        }
+        for (int j = 0; j < N; j++) {
+            int32_t d[N];
+            for (int i = 0; i < N; i++) {
+                d[i] = tmp[i * N + j];
+            }
+            butterfly(d, scalar_ops{});
+            for (int i = 0; i < N; i++) {
+                block[i * N + j] = descale(d[i]);
+            }
+        }
+    }
+
+#ifdef __AVX2__
+    // 每個 YMM 放一行 8 個 int32, butterfly 在暫存器之間做, 8 個 lane 同時算 8 行
+    template <typename T>
+    static void dct_avx2(std::array<T, N * N> &block) {
+        __m256i d[N];
+        for (int i = 0; i < N; i++) {
+            d[i] = _mm256_slli_epi32(load_row(&block[i * N]), pass1_bits);
+        }
+        transpose_8x8(d);  // lane i = 第 i 列
+        butterfly(d, avx2_ops{});
+        transpose_8x8(d);  // lane j = 第 j 行
+        butterfly(d, avx2_ops{});
+        const auto round = _mm256_set1_epi32(1 << (descale_bits - 1));
+        for (int i = 0; i < N; i++) {
+            store_row(&block[i * N], _mm256_srai_epi32(_mm256_add_epi32(d[i], round), descale_bits));
+        }
+    }
+#endif
+
+private:
+    static constexpr int descale_bits = 3 + pass1_bits - output_bits;
+
+    // round(x * 2^const_bits)
+    static constexpr int32_t fix_0_382683433 = 3135;
+    static constexpr int32_t fix_0_541196100 = 4433;
+    static constexpr int32_t fix_0_707106781 = 5793;
+    static constexpr int32_t fix_1_306562965 = 10703;
+
+    static int32_t descale(int32_t x) {
+        return (x + (1 << (descale_bits - 1))) >> descale_bits;
+    }
+
+    // d[0..7] 原地做一次 1-D AAN, 輸出依照自然順序
+    // scalar 跟 SIMD 共用同一份 butterfly, 結果逐位元相同
+    template <typename V, typename Ops>
+    static void butterfly(V (&d)[N], Ops ops) {
+        const V tmp0 = ops.add(d[0], d[7]);
+        const V tmp7 = ops.sub(d[0], d[7]);
+        const V tmp1 = ops.add(d[1], d[6]);
+        const V tmp6 = ops.sub(d[1], d[6]);
+        const V tmp2 = ops.add(d[2], d[5]);
+        const V tmp5 = ops.sub(d[2], d[5]);
+        const V tmp3 = ops.add(d[3], d[4]);
+        const V tmp4 = ops.sub(d[3], d[4]);
+
+        // even part
+        V tmp10 = ops.add(tmp0, tmp3);
+        const V tmp13 = ops.sub(tmp0, tmp3);
+        V tmp11 = ops.add(tmp1, tmp2);
+        V tmp12 = ops.sub(tmp1, tmp2);
+
+        d[0] = ops.add(tmp10, tmp11);
+        d[4] = ops.sub(tmp10, tmp11);
+        const V z1 = ops.mul(ops.add(tmp12, tmp13), fix_0_707106781);
+        d[2] = ops.add(tmp13, z1);
+        d[6] = ops.sub(tmp13, z1);
+
+        // odd part
+        tmp10 = ops.add(tmp4, tmp5);
+        tmp11 = ops.add(tmp5, tmp6);
+        tmp12 = ops.add(tmp6, tmp7);
+
+        const V z5 = ops.mul(ops.sub(tmp10, tmp12), fix_0_382683433);
+        const V z2 = ops.add(ops.mul(tmp10, fix_0_541196100), z5);
+        const V z4 = ops.add(ops.mul(tmp12, fix_1_306562965), z5);
+        const V z3 = ops.mul(tmp11, fix_0_707106781);
+
+        const V z11 = ops.add(tmp7, z3);
+        const V z13 = ops.sub(tmp7, z3);
+
+        d[5] = ops.add(z13, z2);
+        d[3] = ops.sub(z13, z2);
+        d[1] = ops.add(z11, z4);
+        d[7] = ops.sub(z11, z4);
+    }
+
+    struct scalar_ops {
+        static int32_t add(int32_t a, int32_t b) {
+            return a + b;
+        }
+        static int32_t sub(int32_t a, int32_t b) {
+            return a - b;
+        }
+        static int32_t mul(int32_t a, int32_t c) {
+            return (a * c + (1 << (const_bits - 1))) >> const_bits;
+        }
+    };
+
+#ifdef __AVX2__
+    struct avx2_ops {
+        static __m256i add(__m256i a, __m256i b) {
+            return _mm256_add_epi32(a, b);
+        }
+        static __m256i sub(__m256i a, __m256i b) {
+            return _mm256_sub_epi32(a, b);
+        }
+        static __m256i mul(__m256i a, int32_t c) {
+            const auto product = _mm256_mullo_epi32(a, _mm256_set1_epi32(c));
+            return _mm256_srai_epi32(_mm256_add_epi32(product, _mm256_set1_epi32(1 << (const_bits - 1))),
+                                     const_bits);
+        }
+    };
+
+    template <typename T>
+    static __m256i load_row(const T *src) {
+        if constexpr (sizeof(T) == 4) {
+            return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+        } else {
+            static_assert(sizeof(T) == 2);
+            return _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)));
+        }
+    }
+
+    template <typename T>
+    static void store_row(T *dst, __m256i v) {
+        if constexpr (sizeof(T) == 4) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), v);
+        } else {
+            static_assert(sizeof(T) == 2);
+            const auto packed = _mm256_packs_epi32(v, _mm256_permute2x128_si256(v, v, 1));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm256_castsi256_si128(packed));
+        }
+    }
+
+#endif
+};
+
+// 解碼用的整數 IDCT, 跟 libjpeg 的 jidctint (islow) 同一套演算法, 每個 1-D pass 12 個乘法
+// 輸入是反量化後自然順序的係數, 輸出加回 128 並限制在 0 ~ 255
+// 運算都是 32 bit 補數溢位, scalar 跟 SIMD 逐位元相同
+class Idct_int {
+    static constexpr int N = 8;
+
+public:
+    using block_t = std::array<int32_t, N * N>;
+
+    static constexpr int const_bits = 13;
+    static constexpr int pass1_bits = 2;
+
+    static void idct(const block_t &block, uint8_t *out, std::ptrdiff_t stride) {
+#ifdef __AVX2__
+        idct_avx2(block, out, stride);
+#else
+        idct_scalar(block, out, stride);
+#endif
+    }
+
+    // 只有 DC 的 block, 結果跟完整的 idct 相同
+    // size < 8 時輸出縮小的 size x size block, size = 1 就是 1/8 縮圖
+    static void idct_dc(int32_t dc, uint8_t *out, std::ptrdiff_t stride, int size = N) {
+        const auto value = static_cast<uint8_t>(std::clamp(((dc + 4) >> 3) + 128, 0, 255));
+        for (int i = 0; i < size; i++) {
+            std::fill_n(out + i * stride, size, value);
+        }
+    }
+
+    // 1/2 縮圖: 只用左上 4x4 的低頻係數做 4 點 IDCT (libjpeg 的 jpeg_idct_4x4)
+    // 8 點 IDCT 在 4 個位置取樣, 正規化跟 8x8 相同, 所以 DC 的結果跟 idct_dc 一樣
+    static void idct_4x4(const block_t &block, uint8_t *out, std::ptrdiff_t stride) {
+        int32_t tmp[4 * 4];
+        for (int j = 0; j < 4; j++) {
+            int32_t d[4];
+            for (int i = 0; i < 4; i++) {
+                d[i] = block[i * N + j];
+            }
+            butterfly_4(d, const_bits - pass1_bits);
+            for (int i = 0; i < 4; i++) {
+                tmp[i * 4 + j] = d[i];
+            }
+        }
+        for (int i = 0; i < 4; i++) {
+            int32_t d[4];
+            std::copy_n(&tmp[i * 4], 4, d);
+            butterfly_4(d, const_bits + pass1_bits + 3);
+            for (int j = 0; j < 4; j++) {
+                out[i * stride + j] = static_cast<uint8_t>(std::clamp(d[j] + 128, 0, 255));
+            }
+        }
+    }
+
+    // 1/4 縮圖: 只用左上 2x2 的係數, 2 點 IDCT 只需要加減
+    static void idct_2x2(const block_t &block, uint8_t *out, std::ptrdiff_t stride) {
+        const int32_t sum0 = block[0] + block[N];
+        const int32_t diff0 = block[0] - block[N];
+        const int32_t sum1 = block[1] + block[N + 1];
+        const int32_t diff1 = block[1] - block[N + 1];
+        const auto put = [](int32_t x) {
+            return static_cast<uint8_t>(std::clamp(((x + 4) >> 3) + 128, 0, 255));
+        };
+        out[0] = put(sum0 + sum1);
+        out[1] = put(sum0 - sum1);
+        out[stride] = put(diff0 + diff1);
+        out[stride + 1] = put(diff0 - diff1);
+    }
+
+    static void idct_scalar(const block_t &block, uint8_t *out, std::ptrdiff_t stride) {
+        int32_t tmp[N * N];
+        for (int j = 0; j < N; j++) {
+            int32_t d[N];
+            for (int i = 0; i < N; i++) {
+                d[i] = block[i * N + j];
+            }
+            butterfly(d, scalar_ops{}, const_bits - pass1_bits);
+            for (int i = 0; i < N; i++) {
+                tmp[i * N + j] = d[i];
+            }
+        }
+        for (int i = 0; i < N; i++) {
+            int32_t d[N];
+            for (int j = 0; j < N; j++) {
+                d[j] = tmp[i * N + j];
+            }
+            butterfly(d, scalar_ops{}, const_bits + pass1_bits + 3);
+            for (int j = 0; j < N; j++) {
+                out[i * stride + j] = static_cast<uint8_t>(std::clamp(d[j] + 128, 0, 255));
+            }
+        }
+    }
+
+#ifdef __AVX2__
+    // 每個 YMM 放一列, 第一個 pass 8 個 lane 同時算 8 行, 轉置後第二個 pass 算 8 列
+    static void idct_avx2(const block_t &block, uint8_t *out, std::ptrdiff_t stride) {
+        __m256i d[N];
+        for (int i = 0; i < N; i++) {
+            d[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&block[i * N]));
+        }
+        butterfly(d, avx2_ops{}, const_bits - pass1_bits);
+        transpose_8x8(d);  // lane j = 第 j 列
+        butterfly(d, avx2_ops{}, const_bits + pass1_bits + 3);
+        transpose_8x8(d);
+        const auto offset = _mm256_set1_epi32(128);
+        for (int i = 0; i < N; i++) {
+            // packs / packus 順便做 0 ~ 255 的飽和
+            const auto words = _mm256_packs_epi32(_mm256_add_epi32(d[i], offset), _mm256_setzero_si256());
+            const auto bytes = _mm256_packus_epi16(words, words);
+            const uint32_t low = _mm_cvtsi128_si32(_mm256_castsi256_si128(bytes));
+            const uint32_t high = _mm_cvtsi128_si32(_mm256_extracti128_si256(bytes, 1));
+            std::memcpy(out + i * stride, &low, 4);
+            std::memcpy(out + i * stride + 4, &high, 4);
+        }
+    }
+#endif
+
+private:
+    // round(x * 2^const_bits)
+    static constexpr int32_t fix_0_298631336 = 2446;
+    static constexpr int32_t fix_0_390180644 = 3196;
+    static constexpr int32_t fix_0_541196100 = 4433;
+    static constexpr int32_t fix_0_765366865 = 6270;
+    static constexpr int32_t fix_0_899976223 = 7373;
+    static constexpr int32_t fix_1_175875602 = 9633;
+    static constexpr int32_t fix_1_501321110 = 12299;
+    static constexpr int32_t fix_1_847759065 = 15137;
+    static constexpr int32_t fix_1_961570560 = 16069;
+    static constexpr int32_t fix_2_053119869 = 16819;
+    static constexpr int32_t fix_2_562915447 = 20995;
+    static constexpr int32_t fix_3_072711026 = 25172;
+
+    // d[0..3] 原地做一次 4 點 1-D IDCT, 輸入是 8 點 IDCT 的前 4 個係數
+    static void butterfly_4(int32_t (&d)[4], int shift) {
+        const scalar_ops ops;
+        const int32_t tmp10 = ops.shl(ops.add(d[0], d[2]), const_bits);
+        const int32_t tmp12 = ops.shl(ops.sub(d[0], d[2]), const_bits);
+        const int32_t z1 = ops.mul(ops.add(d[1], d[3]), fix_0_541196100);
+        const int32_t tmp0 = ops.add(z1, ops.mul(d[1], fix_0_765366865));
+        const int32_t tmp2 = ops.sub(z1, ops.mul(d[3], fix_1_847759065));
+        d[0] = ops.descale(ops.add(tmp10, tmp0), shift);
+        d[3] = ops.descale(ops.sub(tmp10, tmp0), shift);
+        d[1] = ops.descale(ops.add(tmp12, tmp2), shift);
+        d[2] = ops.descale(ops.sub(tmp12, tmp2), shift);
+    }
+
+    // d[0..7] 原地做一次 1-D IDCT, 最後右移 shift bit (四捨五入)
+    template <typename V, typename Ops>
+    static void butterfly(V (&d)[N], Ops ops, int shift) {
+        // even part
+        V z1 = ops.mul(ops.add(d[2], d[6]), fix_0_541196100);
+        V tmp2 = ops.add(z1, ops.mul(d[6], -fix_1_847759065));
+        V tmp3 = ops.add(z1, ops.mul(d[2], fix_0_765366865));
+        V tmp0 = ops.shl(ops.add(d[0], d[4]), const_bits);
+        V tmp1 = ops.shl(ops.sub(d[0], d[4]), const_bits);
+
+        const V tmp10 = ops.add(tmp0, tmp3);
+        const V tmp13 = ops.sub(tmp0, tmp3);
+        const V tmp11 = ops.add(tmp1, tmp2);
+        const V tmp12 = ops.sub(tmp1, tmp2);
+
+        // odd part
+        tmp0 = d[7];
+        tmp1 = d[5];
+        tmp2 = d[3];
+        tmp3 = d[1];
+        z1 = ops.add(tmp0, tmp3);
+        V z2 = ops.add(tmp1, tmp2);
+        V z3 = ops.add(tmp0, tmp2);
+        V z4 = ops.add(tmp1, tmp3);
+        const V z5 = ops.mul(ops.add(z3, z4), fix_1_175875602);
+
+        tmp0 = ops.mul(tmp0, fix_0_298631336);
+        tmp1 = ops.mul(tmp1, fix_2_053119869);
+        tmp2 = ops.mul(tmp2, fix_3_072711026);
+        tmp3 = ops.mul(tmp3, fix_1_501321110);
+        z1 = ops.mul(z1, -fix_0_899976223);
+        z2 = ops.mul(z2, -fix_2_562915447);
+        z3 = ops.add(ops.mul(z3, -fix_1_961570560), z5);
+        z4 = ops.add(ops.mul(z4, -fix_0_390180644), z5);
+
+        tmp0 = ops.add(tmp0, ops.add(z1, z3));
+        tmp1 = ops.add(tmp1, ops.add(z2, z4));
+        tmp2 = ops.add(tmp2, ops.add(z2, z3));
+        tmp3 = ops.add(tmp3, ops.add(z1, z4));
+
+        d[0] = ops.descale(ops.add(tmp10, tmp3), shift);
+        d[7] = ops.descale(ops.sub(tmp10, tmp3), shift);
+        d[1] = ops.descale(ops.add(tmp11, tmp2), shift);
+        d[6] = ops.descale(ops.sub(tmp11, tmp2), shift);
+        d[2] = ops.descale(ops.add(tmp12, tmp1), shift);
+        d[5] = ops.descale(ops.sub(tmp12, tmp1), shift);
+        d[3] = ops.descale(ops.add(tmp13, tmp0), shift);
+        d[4] = ops.descale(ops.sub(tmp13, tmp0), shift);
+    }
+
+    // 損壞的檔案可能讓中間值溢位, 用 unsigned 運算讓結果跟 SIMD 一樣環繞
+    struct scalar_ops {
+        static int32_t add(int32_t a, int32_t b) {
+            return static_cast<int32_t>(static_cast<uint32_t>(a) + static_cast<uint32_t>(b));
+        }
+        static int32_t sub(int32_t a, int32_t b) {
+            return static_cast<int32_t>(static_cast<uint32_t>(a) - static_cast<uint32_t>(b));
+        }
+        static int32_t mul(int32_t a, int32_t c) {
+            return static_cast<int32_t>(static_cast<uint32_t>(a) * static_cast<uint32_t>(c));
+        }
+        static int32_t shl(int32_t a, int bits) {
+            return static_cast<int32_t>(static_cast<uint32_t>(a) << bits);
+        }
+        static int32_t descale(int32_t a, int bits) {
+            return add(a, 1 << (bits - 1)) >> bits;
+        }
+    };
+
+#ifdef __AVX2__
+    struct avx2_ops {
+        static __m256i add(__m256i a, __m256i b) {
+            return _mm256_add_epi32(a, b);
+        }
+        static __m256i sub(__m256i a, __m256i b) {
+            return _mm256_sub_epi32(a, b);
+        }
+        static __m256i mul(__m256i a, int32_t c) {
+            return _mm256_mullo_epi32(a, _mm256_set1_epi32(c));
+        }
+        static __m256i shl(__m256i a, int bits) {
+            return _mm256_slli_epi32(a, bits);
+        }
+        static __m256i descale(__m256i a, int bits) {
+            return _mm256_srai_epi32(_mm256_add_epi32(a, _mm256_set1_epi32(1 << (bits - 1))), bits);
+        }
+    };
+#endif
+};
+
 };  // namespace f9ay
\ No newline at end of file
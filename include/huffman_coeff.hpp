@@ -0,0 +1,13 @@
+#pragma once
+#include <cstdint>
+
+namespace f9ay {
+// 一個 huffman code: value 的低 length 個 bit
+struct huffman_coeff {
+    uint16_t value;
+    uint16_t length;
+    bool operator!=(const huffman_coeff& other) const {
+        return value != other.value || length != other.length;
+    }
+};
+}  // namespace f9ay
@@ -10,15 +10,9 @@
 #include <ranges>
 #include <unordered_map>
 
-namespace f9ay {
-struct huffman_coeff {
-    uint16_t value;
-    uint16_t length;
-    bool operator!=(const huffman_coeff& other) const {
-        return value != other.value || length != other.length;
-    }
-};
+#include "huffman_coeff.hpp"
 
+namespace f9ay {
 class Huffman_tree_no_limit {
 public:
     struct tree_node {
@@ -1,30 +1,133 @@
 ﻿#pragma once
+#include <immintrin.h>
 
 #include <algorithm>
 #include <any>
+#include <bit>
 #include <bitset>
+#include <concepts>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <ranges>
+#include <span>
+#include <stdexcept>
 #include <utility>
 #include <vector>
 
+#include "color_convert.hpp"
 #include "dct.hpp"
-#include "huffman_tree.hpp"
 #include "importer.hpp"
+#include "jpeg_arithmetic.hpp"
+#include "jpeg_bit_writer.hpp"
+#include "jpeg_decoder.hpp"
+#include "jpeg_huffman.hpp"
+#include "jpeg_progressive.hpp"
+#include "jpeg_quantize.hpp"
+#include "jpeg_transform.hpp"
 #include "matrix.hpp"
 #include "matrix_concept.hpp"
 #include "matrix_view.hpp"
+#include "parallel.hpp"
 #include "steal_vector.hpp"
 #include "util.hpp"
 
 namespace f9ay {
 
-enum class Jpeg_sampling { ds_4_4_4, ds_4_2_0 };
+enum class Jpeg_sampling {
+    ds_4_4_4,
+    ds_4_2_0,   // Cb Cr 水平垂直都減半
+    ds_4_2_2,   // Cb Cr 只有水平減半
+    ds_4_4_0,   // Cb Cr 只有垂直減半
+    grayscale,  // 只有 Y 一個 component, 不做 Cb Cr 的轉換、DCT 跟熵編碼
+};
+
+enum class Jpeg_dct {
+    float_matrix,  // Dct<8>, 浮點矩陣乘法
+    // Dct_aan, 整數 butterfly, 縮放折進整數量化表
+    // 色彩轉換、DCT、量化全部是定點整數, 輸出跟編譯器、浮點選項、有沒有 AVX2 無關
+    aan_integer,
+};
+
+enum class Jpeg_huffman {
+    optimized,  // 先統計整張圖再建表, 檔案最小
+    standard,   // Annex K 的典型表, 量化完馬上熵編碼, 只需要一趟
+    // 只統計每 huffman_sample_rows 個 MCU row 的第一列就建表, 沒統計到的 symbol 也有 code
+    // 表稍微比 optimized 差, 但統計完就能開始串流輸出, 不用保留整張圖的 token
+    sampled,
+};
+
+enum class Jpeg_entropy {
+    huffman,
+    // T.81 Annex D 的算術編碼 (SOF9), 機率邊編碼邊適應, 不需要 huffman 表也不用先統計, 檔案通常小 5 ~ 10%
+    // 只支援 sequential, options.huffman 不使用; 解碼比 huffman 慢, 而且不是每個 decoder 都支援
+    arithmetic,
+};
+
+struct Jpeg_options {
+    Jpeg_dct dct = Jpeg_dct::float_matrix;
+    Jpeg_entropy entropy = Jpeg_entropy::huffman;
+    Jpeg_huffman huffman = Jpeg_huffman::optimized;
+    int huffman_sample_rows = 8;  // Jpeg_huffman::sampled 的取樣間隔
+    // 1 ~ 100 跟 libjpeg 一樣縮放標準量化表, 0 使用內建的表 (約 quality 94)
+    int quality = 0;
+    // 大於 0 時每 restart_rows 個 MCU row 是一個 restart interval (DRI / RSTn)
+    // 每個 interval 的 DC 預測各自從 0 開始, 可以分給不同執行緒轉換和熵編碼
+    int restart_rows = 0;
+    // write() 使用的執行緒數, 0 = 全部硬體執行緒, 輸出跟執行緒數無關
+    // 有 restart interval 時每個 interval 整個交給一個執行緒, 沒有時只平行處理熵編碼以前的部分
+    int threads = 1;
+    // 非空時輸出 progressive JPEG (SOF2), 依序寫出每個 scan, 可以用 Jpeg_scan::default_script()
+    // progressive 需要保留整張圖的係數, huffman 一定用每個 scan 各自統計的表, 不使用 restart interval
+    std::vector<Jpeg_scan> scans;
+};
+
+// fetch_row(i) 回傳第 i 列 pixel 的指標, 只需要在下一次呼叫前保持有效
+template <typename F>
+concept Jpeg_row_source = requires(F &fetch_row, int row) {
+    requires colors::color_type<std::remove_cvref_t<decltype(*fetch_row(row))>>;
+};
+
+enum class Jpeg_yuv_layout {
+    i420,    // Y, U, V 三個平面, U V 水平垂直都減半
+    nv12,    // Y 平面加上一個 U V 交錯的平面, U V 水平垂直都減半
+    yuv444,  // Y, U, V 三個一樣大的平面
+};
+
+// write_yuv 的輸入, 每個 sample 一個 byte, stride 是相鄰兩列開頭的 byte 距離
+// 值直接當成 JFIF 的 Y Cb Cr (full range BT.601), 不做任何轉換; limited range 的影像要先自己展開
+struct Jpeg_yuv_planes {
+    int width = 0;
+    int height = 0;
+    Jpeg_yuv_layout layout = Jpeg_yuv_layout::i420;
+    const uint8_t *y = nullptr;
+    int y_stride = 0;
+    const uint8_t *u = nullptr;  // nv12 時是 U V 交錯的平面
+    int u_stride = 0;
+    const uint8_t *v = nullptr;  // nv12 不使用
+    int v_stride = 0;
+};
+
+// 編碼器內部的輸入: 一列一列的 pixel, 或是已經是 YCbCr 的平面
+template <typename S>
+concept Jpeg_stripe_source = Jpeg_row_source<S> || std::same_as<std::remove_cvref_t<S>, Jpeg_yuv_planes>;
+
+template <Jpeg_sampling sampling_type>
+class Jpeg_encoder;
 
 template <Jpeg_sampling sampling_type = Jpeg_sampling::ds_4_2_0>
 class Jpeg {
+    friend class Jpeg_encoder<sampling_type>;
+
+    // Y 的 sampling factor, Cb Cr 固定為 1x1
+    static constexpr int h_max =
+        sampling_type == Jpeg_sampling::ds_4_2_0 || sampling_type == Jpeg_sampling::ds_4_2_2 ? 2 : 1;
+    static constexpr int v_max =
+        sampling_type == Jpeg_sampling::ds_4_2_0 || sampling_type == Jpeg_sampling::ds_4_4_0 ? 2 : 1;
+    static constexpr int component_count = sampling_type == Jpeg_sampling::grayscale ? 1 : 3;
+    static constexpr int mcu_width = 8 * h_max;
+    static constexpr int mcu_height = 8 * v_max;
+
 private:
 #pragma pack(push, 1)
     struct JFIF_APP0 {
@@ -48,15 +151,6 @@ private:
     static_assert(sizeof(JFIF_extension_APP0) == 10);
 
 public:
-    struct bit_content {
-        uint32_t value;
-        uint8_t size;
-        bit_content() = default;
-        bit_content(uint32_t v, uint8_t s) : value(v), size(s) {}
-
-        template <class T, class U>
-        bit_content(const std::pair<T, U> &p) : value(p.first), size(p.second) {}
-    };
     template <int n>
     static consteval auto zigzag() {
         std::array<std::pair<int, int>, n * n> res;
@@ -104,88 +198,14 @@ public:
     }
 
 public:
-    static auto convert_dc_to_size_value(auto &dc) {
-        return dc | std::views::all | std::views::transform([](auto &x) {
-                   uint32_t value = 0;
-                   if (x >= 0) {
-                       value = x;
-                   } else {
-                       value = (1 << category(x)) - 1 + x;
-                   }
-                   return std::pair<uint8_t, uint32_t>{category(x), value};  // size value
-               });
-    }
-
-private:
-    static auto build_huffman_tree(std::vector<std::vector<int32_t>> &dcs,
-                                   std::vector<std::vector<std::vector<std::pair<unsigned char, int>>>> &acs) {
-        Huffman_tree y_dc;
-        for (const auto &[cat, value] : convert_dc_to_size_value(dcs[0])) {
-            y_dc.add_one(cat);
-        }
-        y_dc.build<16>();
-        Huffman_tree y_ac;
-        for (auto &ac : acs[0]) {
-            for (auto &[first, value] : ac) {
-                y_ac.add_one(first);
-            }
-        }
-        y_ac.build<16>();
-        ///////////////////////////////
-        /// CB CR
-        //////////////////////////////
-        Huffman_tree uv_dc;
-        for (const auto &[cat, value] : convert_dc_to_size_value(dcs[1])) {
-            uv_dc.add_one(cat);
-        }
-        for (const auto &[cat, value] : convert_dc_to_size_value(dcs[2])) {
-            uv_dc.add_one(cat);
-        }
-        uv_dc.build<16>();
-        ////////////////////
-        Huffman_tree uv_ac;
-        for (auto &ac : acs[1]) {
-            for (auto &[first, value] : ac) {
-                uv_ac.add_one(first);
-            }
-        }
-        for (auto &ac : acs[2]) {
-            for (auto &[first, value] : ac) {
-                uv_ac.add_one(first);
-            }
-        }
-        uv_ac.build<16>();
-
-        return std::make_tuple(std::move(y_dc), std::move(y_ac), std::move(uv_dc), std::move(uv_ac));
-    }
-
-    static auto encode_huffman_dc(auto &dc, auto &huffman) {
-        std::vector<std::pair<bit_content, std::optional<bit_content>>> result;
-        for (const auto &[cat, value] : convert_dc_to_size_value(dc)) {
-            auto enc = huffman.getMapping(cat);
-            auto val_len_pair = bit_content(enc.value, enc.length);
-            if (cat == 0) {
-                result.push_back({val_len_pair, std::nullopt});
-            } else {
-                result.push_back({val_len_pair, std::pair{value, cat}});
-            }
-        }
-        return result;
-    }
-
-    static auto encode_huffman_ac(auto &ac, auto &huffman) {
-        std::vector<std::pair<bit_content, std::optional<bit_content>>> result;
-        for (auto &[first, value] : ac) {
-            auto enc = huffman.getMapping(first);
-            auto val_len_pair = bit_content(enc.value, enc.length);
-            auto size = first & 0xFu;
-            if (size == 0) {
-                result.push_back({val_len_pair, std::nullopt});
-            } else {
-                result.push_back({val_len_pair, std::pair{value, size}});
-            }
+    static std::pair<uint8_t, uint32_t> dc_to_size_value(int32_t x) {
+        uint32_t value = 0;
+        if (x >= 0) {
+            value = x;
+        } else {
+            value = (1 << category(x)) - 1 + x;
         }
-        return result;
+        return {category(x), value};  // size value
     }
 
 private:
@@ -199,7 +219,6 @@ private:
         }
     }
 
-    inline static int cnt = 0;
     template <typename T, std::endian endian = std::endian::native>
     static void write_data(std::vector<std::byte> &buffer, const T &val) {
         if constexpr (sizeof(T) == 1) {
@@ -239,326 +258,1113 @@ private:
         for (const auto &[i, j] : zigzag<8>()) {
             write_data<uint8_t>(buffer, qt_y[i][j]);
         }
-        write_data<uint8_t>(buffer, 1);  // 1 for cbcr
-        for (const auto &[i, j] : zigzag<8>()) {
-            write_data<uint8_t>(buffer, qt_uv[i][j]);
+        if constexpr (component_count == 3) {
+            write_data<uint8_t>(buffer, 1);  // 1 for cbcr
+            for (const auto &[i, j] : zigzag<8>()) {
+                write_data<uint8_t>(buffer, qt_uv[i][j]);
+            }
         }
         write_byte<uint16_t, std::endian::big>(&buffer[size_index], buffer.size() - size_index);  // 填入 size
     }
 
-    static void write_huffman_all(std::vector<std::byte> &buffer, Huffman_tree &y_dc, Huffman_tree &y_ac,
-                                  Huffman_tree &uv_dc, Huffman_tree &uv_ac) {
+    static void write_huffman_all(std::vector<std::byte> &buffer, const Jpeg_huffman_tables &tables) {
         write_data<uint16_t, std::endian::big>(buffer, 0xFFC4u);
         int size_index = buffer.size();
         buffer.resize(buffer.size() + 2);
         /* Y DC segment */
         write_data<uint8_t>(buffer, 0);  // [DC : 0  ac : 1 ; ID]
-        write_huffman_data(buffer, y_dc);
+        write_huffman_data(buffer, tables.y_dc);
         /* Y AC segment */
         write_data<uint8_t>(buffer, (1u << 4) | 0);
-        write_huffman_data(buffer, y_ac);
-        /* CB CR  DC segment */
-        write_data<uint8_t>(buffer, 1);
-        write_huffman_data(buffer, uv_dc);
-        /* CB CR  AC segment */
-        write_data<uint8_t>(buffer, (1u << 4) | 1);
-        write_huffman_data(buffer, uv_ac);
+        write_huffman_data(buffer, tables.y_ac);
+        if constexpr (component_count == 3) {
+            /* CB CR  DC segment */
+            write_data<uint8_t>(buffer, 1);
+            write_huffman_data(buffer, tables.uv_dc);
+            /* CB CR  AC segment */
+            write_data<uint8_t>(buffer, (1u << 4) | 1);
+            write_huffman_data(buffer, tables.uv_ac);
+        }
 
         write_byte<uint16_t, std::endian::big>(&buffer[size_index], buffer.size() - size_index);  // 填入 size
     }
 
-    static void write_huffman_data(std::vector<std::byte> &buffer, Huffman_tree &tree) {
-        std::array<uint8_t, 16> bits_array{};
-        for (const auto &[len, cnt] : tree.get_numOfLength()) {
-            if (cnt == 0) {
-                continue;
-            }
-            if (len == 0 || len > 16) [[unlikely]] {
-                throw std::runtime_error("error : length out of range");
-            }
-            bits_array[len - 1] = cnt;
-        }
-        write_data(buffer, bits_array);
-        for (const auto &val : tree.get_standard_huffman_table() | std::views::keys) {
+    static void write_huffman_data(std::vector<std::byte> &buffer, const Jpeg_huffman_table &table) {
+        write_data(buffer, table.bits);
+        for (const auto &val : table.symbols()) {
             write_data<uint8_t>(buffer, val);
         }
     }
-    static void write_sof0_segment(std::vector<std::byte> &buffer, int height, int width) {
-        write_data<uint16_t, std::endian::big>(buffer, 0xFFC0u);
+    // marker: SOF0 (baseline), SOF2 (progressive) 或 SOF9 (算術編碼)
+    static void write_sof_segment(std::vector<std::byte> &buffer, int height, int width, uint16_t marker = 0xFFC0u) {
+        write_data<uint16_t, std::endian::big>(buffer, marker);
         int size_index = buffer.size();
         buffer.resize(buffer.size() + 2);
         write_data<uint8_t>(buffer, 8);  // precision
         write_data<uint16_t, std::endian::big>(buffer, height);
         write_data<uint16_t, std::endian::big>(buffer, width);
-        write_data<uint8_t>(buffer, 3);  // 3 channels
+        write_data<uint8_t>(buffer, component_count);
 
         // Channel: Y
-        write_data<uint8_t>(buffer, 1);  // component ID: Y
-        if constexpr (sampling_type == Jpeg_sampling::ds_4_2_0) {
-            write_data<uint8_t>(buffer, 0x22);  // sampling factors (4:2:0)
-        } else {
-            write_data<uint8_t>(buffer, 0x11);  // sampling factors (4:4:4)
-        }
-        write_data<uint8_t>(buffer, 0);  // quant table ID: 0
+        write_data<uint8_t>(buffer, 1);                   // component ID: Y
+        write_data<uint8_t>(buffer, h_max << 4 | v_max);  // sampling factors: H, V
+        write_data<uint8_t>(buffer, 0);                   // quant table ID: 0
 
-        // Channel: Cb
-        write_data<uint8_t>(buffer, 2);     // component ID: Cb
-        write_data<uint8_t>(buffer, 0x11);  // sampling factors: H=1, V=1
-        write_data<uint8_t>(buffer, 1);     // quant table ID: 1
+        if constexpr (component_count == 3) {
+            // Channel: Cb
+            write_data<uint8_t>(buffer, 2);     // component ID: Cb
+            write_data<uint8_t>(buffer, 0x11);  // sampling factors: H=1, V=1
+            write_data<uint8_t>(buffer, 1);     // quant table ID: 1
 
-        // Channel: Cr
-        write_data<uint8_t>(buffer, 3);     // component ID: Cr
-        write_data<uint8_t>(buffer, 0x11);  // sampling factors: H=1, V=1
-        write_data<uint8_t>(buffer, 1);     // quant table ID: 1
+            // Channel: Cr
+            write_data<uint8_t>(buffer, 3);     // component ID: Cr
+            write_data<uint8_t>(buffer, 0x11);  // sampling factors: H=1, V=1
+            write_data<uint8_t>(buffer, 1);     // quant table ID: 1
+        }
 
         write_byte<uint16_t, std::endian::big>(&buffer[size_index], buffer.size() - size_index);  // 填入 size
     }
-    static void write_binary_stream(
-        std::vector<std::byte> &buffer, Huffman_tree &y_dc_huffman, Huffman_tree &y_ac_huffman,
-        Huffman_tree &uv_dc_huffman, Huffman_tree &uv_ac_huffman, std::vector<std::vector<int32_t>> &dcs,
-        std::vector<std::vector<std::vector<std::pair<unsigned char, int>>>> &acs) {
+    static void write_sos_header(std::vector<std::byte> &buffer) {
         write_data<uint16_t, std::endian::big>(buffer, 0xFFDAu);
         int size_index = buffer.size();
         buffer.resize(buffer.size() + 2);
-        write_data<uint8_t>(buffer, 3);     // 3 channels for Y Cb Cr
+        write_data<uint8_t>(buffer, component_count);
         write_data<uint8_t>(buffer, 1);     // Y
         write_data<uint8_t>(buffer, 0x00);  // Y huffman id
-        write_data<uint8_t>(buffer, 2);     // Cb
-        write_data<uint8_t>(buffer, 0x11);  // Cb huffman id
-        write_data<uint8_t>(buffer, 3);     // Cr
-        write_data<uint8_t>(buffer, 0x11);  // Cr huffman id
+        if constexpr (component_count == 3) {
+            write_data<uint8_t>(buffer, 2);     // Cb
+            write_data<uint8_t>(buffer, 0x11);  // Cb huffman id
+            write_data<uint8_t>(buffer, 3);     // Cr
+            write_data<uint8_t>(buffer, 0x11);  // Cr huffman id
+        }
         write_data<uint8_t>(buffer, 0x00);  // Ss = 0
         write_data<uint8_t>(buffer, 0x3F);  // Se = 63
         write_data<uint8_t>(buffer, 0x00);  // Successive Approximation Bit Setting, Ah/Al
         write_byte<uint16_t, std::endian::big>(&buffer[size_index], buffer.size() - size_index);  // 填入 size
+    }
+    // 算術編碼的 conditioning, 寫的是預設值, 只是讓 decoder 不用猜
+    static void write_dac_segment(std::vector<std::byte> &buffer) {
+        constexpr Jpeg_arithmetic_conditioning conditioning;
+        constexpr int table_count = component_count == 3 ? 2 : 1;
+        write_data<uint16_t, std::endian::big>(buffer, 0xFFCCu);
+        write_data<uint16_t, std::endian::big>(buffer, static_cast<uint16_t>(2 + table_count * 4));
+        for (int table = 0; table < table_count; table++) {
+            write_data<uint8_t>(buffer, table);  // DC, Tb
+            write_data<uint8_t>(buffer, conditioning.dc_u << 4 | conditioning.dc_l);
+            write_data<uint8_t>(buffer, 0x10 | table);  // AC, Tb
+            write_data<uint8_t>(buffer, conditioning.ac_k);
+        }
+    }
+    // restart interval 的單位是 MCU
+    static void write_dri_segment(std::vector<std::byte> &buffer, uint16_t restart_interval) {
+        write_data<uint16_t, std::endian::big>(buffer, 0xFFDDu);
+        write_data<uint16_t, std::endian::big>(buffer, 4u);
+        write_data<uint16_t, std::endian::big>(buffer, restart_interval);
+    }
+    // dc_diff 是跟前一個 block 的 DC 差, ac 是 run_length_encode 的結果
+    static void write_block(Jpeg_bit_writer &bit_writer, int32_t dc_diff, std::span<const std::pair<uint8_t, int>> ac,
+                            const Jpeg_huffman_table &dc_table, const Jpeg_huffman_table &ac_table) {
+        const auto [size, amplitude] = dc_to_size_value(dc_diff);
+        bit_writer.write_symbol(dc_table.getMapping(size), amplitude, size);
+        for (const auto &[symbol, value] : ac) {
+            bit_writer.write_symbol(ac_table.getMapping(symbol), value, symbol & 0xFu);
+        }
+    }
+
+    // 一個 MCU row 的 Y Cb Cr (灰階只有 Y), 寬度補齊到 MCU 的倍數 (複製最右邊的 pixel)
+    // 降取樣時 Cb Cr 只有 8 列, 每個值是 h_max x v_max 個 pixel 的和, 在色彩轉換時就累加好
+    struct Mcu_stripe {
+        int width = 0;
+        int chroma_width = 0;
+        std::array<std::vector<int16_t>, component_count> planes;
 
-        BitWriter bit_writer;
-        bit_writer.changeWriteSequence(WriteSequence::MSB);
-        auto y_dc_encoded = encode_huffman_dc(dcs[0], y_dc_huffman);
-        auto cb_dc_encoded = encode_huffman_dc(dcs[1], uv_dc_huffman);
-        auto cr_dc_encoded = encode_huffman_dc(dcs[2], uv_dc_huffman);
-        const size_t mcu_cnt = dcs[1].size();
+        Mcu_stripe() = default;
 
-        size_t mcu_ratio = 1;
-        if constexpr (sampling_type == Jpeg_sampling::ds_4_2_0) {
-            mcu_ratio = 4;
+        explicit Mcu_stripe(int image_width) {
+            resize(image_width);
         }
 
-        for (int i = 0; i < mcu_cnt; i++) {
-            for (int y_index = i * mcu_ratio; y_index < i * mcu_ratio + mcu_ratio && y_index < dcs[0].size();
-                 y_index++) {
-                std::span acspan = acs[0];
-                write_block(bit_writer, y_dc_encoded[y_index], acspan[y_index], y_ac_huffman);
+        // 重複使用時只有比之前寬才會重新配置
+        void resize(int image_width) {
+            width = align<mcu_width>(image_width);
+            chroma_width = width / h_max;
+            planes[0].resize(mcu_height * width);
+            for (int component = 1; component < component_count; component++) {
+                planes[component].resize(8 * chroma_width);
             }
-            {  // cb
-                std::span acspan = acs[1];
-                write_block(bit_writer, cb_dc_encoded[i], acspan[i], uv_ac_huffman);
+        }
+
+        int16_t &at(int component, int i, int j) {
+            return planes[component][i * (component == 0 ? width : chroma_width) + j];
+        }
+    };
+
+    // 讀入第 mcu_row 個 MCU row, 超出圖片的部分複製邊緣
+    template <Jpeg_row_source FetchRow>
+    static void fill_stripe(Mcu_stripe &stripe, int height, int width, int mcu_row, FetchRow &fetch_row) {
+        for (int i = 0; i < mcu_height; i++) {
+            const auto *row = fetch_row(std::min(mcu_row * mcu_height + i, height - 1));
+            if constexpr (h_max * v_max > 1) {
+                // 右邊補齊的部分也由 convert_row_down_sampled 處理
+                Ycbcr_convert::convert_row_down_sampled<h_max>(row, width, stripe.width, &stripe.at(0, i, 0),
+                                                               &stripe.at(1, i / v_max, 0),
+                                                               &stripe.at(2, i / v_max, 0), i % v_max != 0);
+                continue;
+            } else if constexpr (component_count == 3) {
+                Ycbcr_convert::convert_row(row, width, &stripe.at(0, i, 0), &stripe.at(1, i, 0), &stripe.at(2, i, 0));
+            } else {
+                Ycbcr_convert::convert_luma_row(row, width, &stripe.at(0, i, 0));
             }
-            {  // cr
-                std::span acspan = acs[2];
-                write_block(bit_writer, cr_dc_encoded[i], acspan[i], uv_ac_huffman);
+            for (int component = 0; component < component_count; component++) {
+                auto *plane = &stripe.at(component, i, 0);
+                std::fill(plane + width, plane + stripe.width, plane[width - 1]);
             }
         }
+    }
 
-        auto bit_buffer = bit_writer.getBuffer();
+    // 直接從 YUV 平面讀入第 mcu_row 個 MCU row, 不做色彩轉換, 4:2:0 的 U V 本來就減半了也不用再平均
+    // stripe 裡的 Cb Cr 是 h_max x v_max 個 pixel 的和, 所以乘上 pixel 數, 讀 block 時除回來剛好是原值
+    static void fill_stripe(Mcu_stripe &stripe, int height, int width, int mcu_row, const Jpeg_yuv_planes &planes) {
+        for (int i = 0; i < mcu_height; i++) {
+            const std::ptrdiff_t row = std::min(mcu_row * mcu_height + i, height - 1);
+            const auto *src = planes.y + row * planes.y_stride;
+            auto *dst = &stripe.at(0, i, 0);
+            std::copy(src, src + width, dst);
+            std::fill(dst + width, dst + stripe.width, dst[width - 1]);
+        }
+        if constexpr (component_count == 3) {
+            constexpr int weight = h_max * v_max;
+            const int chroma_width = (width + h_max - 1) / h_max;
+            const int chroma_height = (height + v_max - 1) / v_max;
+            for (int i = 0; i < 8; i++) {
+                const std::ptrdiff_t row = std::min(mcu_row * 8 + i, chroma_height - 1);
+                auto *cb = &stripe.at(1, i, 0);
+                auto *cr = &stripe.at(2, i, 0);
+                if (planes.layout == Jpeg_yuv_layout::nv12) {
+                    const auto *uv = planes.u + row * planes.u_stride;
+                    for (int j = 0; j < chroma_width; j++) {
+                        cb[j] = static_cast<int16_t>(uv[2 * j] * weight);
+                        cr[j] = static_cast<int16_t>(uv[2 * j + 1] * weight);
+                    }
+                } else {
+                    const auto *u = planes.u + row * planes.u_stride;
+                    const auto *v = planes.v + row * planes.v_stride;
+                    for (int j = 0; j < chroma_width; j++) {
+                        cb[j] = static_cast<int16_t>(u[j] * weight);
+                        cr[j] = static_cast<int16_t>(v[j] * weight);
+                    }
+                }
+                std::fill(cb + chroma_width, cb + stripe.chroma_width, cb[chroma_width - 1]);
+                std::fill(cr + chroma_width, cr + stripe.chroma_width, cr[chroma_width - 1]);
+            }
+        }
+    }
 
-        for (auto &b : bit_buffer) {
-            write_data(buffer, b);
-            if (b == std::byte{0xFFu}) {
-                write_data<uint8_t>(buffer, 0u);
+    // YUV 的 U V 必須剛好是這個 sampling 的解析度, 灰階只用 Y, 任何 layout 都可以
+    static void validate_yuv_planes(const Jpeg_yuv_planes &planes) {
+        if (planes.width <= 0 || planes.height <= 0 || planes.y == nullptr || planes.y_stride < planes.width) {
+            throw std::invalid_argument("invalid YUV luma plane");
+        }
+        if constexpr (component_count == 3) {
+            const bool half = planes.layout != Jpeg_yuv_layout::yuv444;
+            if (half != (sampling_type == Jpeg_sampling::ds_4_2_0) ||
+                (sampling_type != Jpeg_sampling::ds_4_2_0 && sampling_type != Jpeg_sampling::ds_4_4_4)) {
+                throw std::invalid_argument("YUV layout does not match the JPEG sampling");
+            }
+            const int chroma_width = half ? (planes.width + 1) / 2 : planes.width;
+            const bool nv12 = planes.layout == Jpeg_yuv_layout::nv12;
+            if (planes.u == nullptr || planes.u_stride < (nv12 ? 2 * chroma_width : chroma_width) ||
+                (!nv12 && (planes.v == nullptr || planes.v_stride < chroma_width))) {
+                throw std::invalid_argument("invalid YUV chroma plane");
             }
         }
-        write_data<uint16_t, std::endian::big>(buffer, static_cast<uint16_t>(0xFFD9u));
     }
-    static void write_block(BitWriter &bit_writer, const std::pair<bit_content, std::optional<bit_content>> &dc,
-                            const std::vector<std::pair<unsigned char, int>> &ac, auto &huffman) {
-        auto &[f, s] = dc;
-        bit_writer.writeBitsFromMSB(f.value, f.size);
-        if (s.has_value()) {
-            bit_writer.writeBitsFromMSB(s.value().value, s.value().size);
+
+    using block_t = std::array<int, 8 * 8>;
+
+    // 直接從 stripe 讀出 8x8 block 並減去 128, 邊緣已經在 fill_stripe 複製過了
+    static void load_block(Mcu_stripe &stripe, int component, int top, int left, block_t &block) {
+        const int16_t *src = &stripe.at(component, top, left);
+        for (int i = 0; i < 8; i++) {
+            for (int j = 0; j < 8; j++) {
+                block[i * 8 + j] = src[i * stripe.width + j] - 128;
+            }
         }
-        auto ac_encoded = encode_huffman_ac(ac, huffman);
-        for (auto &[f, s] : ac_encoded) {
-            bit_writer.writeBitsFromMSB(f.value, f.size);
-            if (s.has_value()) {
-                bit_writer.writeBitsFromMSB(s.value().value, s.value().size);
+    }
+
+    // stripe 裡的 Cb Cr 已經是 h_max x v_max 個 pixel 的和, 除完就是平均
+    static void load_down_sampled_block(Mcu_stripe &stripe, int component, int left, block_t &block) {
+        const int16_t *src = &stripe.at(component, 0, left);
+        for (int i = 0; i < 8; i++) {
+            for (int j = 0; j < 8; j++) {
+                block[i * 8 + j] = src[i * stripe.chroma_width + j] / (h_max * v_max) - 128;
+            }
+        }
+    }
+
+    // 量化跟 zigzag 排列一趟完成, block 必須已經做過 options 指定的 DCT
+    static block_t quantize_block(const block_t &block, int component, const Jpeg_options &options) {
+        const auto &tables = Jpeg_quant_tables::get(options.quality);
+        const auto &table = component == 0 ? tables.luma : tables.chroma;
+        // 忽略 uninitialize error 因為每個 index 都會填東西
+        block_t block_zig;  // NOLINT(*-pro-type-member-init)
+        if (options.dct == Jpeg_dct::aan_integer) {
+            table.quantize_aan_zigzag(block, block_zig);
+        } else {
+            table.quantize_zigzag(block, block_zig);
+        }
+        return block_zig;
+    }
+
+    static void dct_blocks(std::span<block_t> blocks, const Jpeg_options &options) {
+        if (options.dct == Jpeg_dct::aan_integer) {
+            for (auto &block : blocks) {
+                Dct_aan::dct(block);
+            }
+        } else {
+            for (auto &block : blocks) {
+                Dct<8>::dct(block);
+            }
+        }
+    }
+
+    // 每個 MCU 依序是 v_max * h_max 個 Y block, 再來 Cb, Cr 各一個 (灰階沒有)
+    constexpr static int blocks_per_mcu = h_max * v_max + component_count - 1;
+
+    static int block_component(int index_in_mcu) {
+        return index_in_mcu < h_max * v_max ? 0 : index_in_mcu - h_max * v_max + 1;
+    }
+
+    static int mcu_row_count(int height) {
+        return (height + mcu_height - 1) / mcu_height;
+    }
+
+    // 一次只處理一個 MCU row, 依照 MCU 的順序把每個量化後的 zigzag block 交給 on_block(component, block)
+    // 整個 MCU row 的 block 先全部取出, 再逐個 block 做 DCT (AVX2 時 8x8 轉置留在暫存器裡), 需要的記憶體只跟寬度有關
+    template <Jpeg_stripe_source FetchRow, typename OnBlock>
+    static void for_each_block(int height, int width, FetchRow &&fetch_row, const Jpeg_options &options,
+                               OnBlock &&on_block) {
+        for_each_block(height, width, 0, mcu_row_count(height), fetch_row, options, on_block);
+    }
+
+    // 只處理 [mcu_row_begin, mcu_row_end) 這幾個 MCU row
+    template <Jpeg_stripe_source FetchRow, typename OnBlock>
+    static void for_each_block(int height, int width, int mcu_row_begin, int mcu_row_end, FetchRow &&fetch_row,
+                               const Jpeg_options &options, OnBlock &&on_block) {
+        for_each_dct_block(height, width, mcu_row_begin, mcu_row_end, fetch_row, options,
+                           [&](int component, block_t &block) {
+                               on_block(component, quantize_block(block, component, options));
+                           });
+    }
+
+    // 跟 for_each_block 一樣, 但只做到 DCT, 交給 on_block(component, block) 的是還沒量化的 block
+    template <Jpeg_stripe_source FetchRow, typename OnBlock>
+    static void for_each_dct_block(int height, int width, int mcu_row_begin, int mcu_row_end, FetchRow &&fetch_row,
+                                   const Jpeg_options &options, OnBlock &&on_block) {
+        Mcu_stripe stripe;
+        std::vector<block_t> blocks;
+        for_each_dct_block(height, width, mcu_row_begin, mcu_row_end, fetch_row, options, stripe, blocks, on_block);
+    }
+
+    // stripe 跟 blocks 是可以重複使用的工作空間, 寬度沒有變大就不會重新配置
+    template <Jpeg_stripe_source FetchRow, typename OnBlock>
+    static void for_each_dct_block(int height, int width, int mcu_row_begin, int mcu_row_end, FetchRow &&fetch_row,
+                                   const Jpeg_options &options, Mcu_stripe &stripe, std::vector<block_t> &blocks,
+                                   OnBlock &&on_block) {
+        stripe.resize(width);
+        blocks.resize(stripe.width / mcu_width * blocks_per_mcu);
+        for (int mcu_row = mcu_row_begin; mcu_row < mcu_row_end; mcu_row++) {
+            fill_stripe(stripe, height, width, mcu_row, fetch_row);
+            auto *block = blocks.data();
+            for (int left = 0; left < stripe.width; left += mcu_width) {
+                for (int i = 0; i < v_max; i++) {
+                    for (int j = 0; j < h_max; j++) {
+                        load_block(stripe, 0, i * 8, left + j * 8, *block++);
+                    }
+                }
+                for (int component = 1; component < component_count; component++) {
+                    if constexpr (h_max * v_max > 1) {
+                        load_down_sampled_block(stripe, component, left / h_max, *block++);
+                    } else {
+                        load_block(stripe, component, 0, left, *block++);
+                    }
+                }
+            }
+            dct_blocks(blocks, options);
+            for (std::size_t k = 0; k < blocks.size(); k++) {
+                on_block(block_component(k % blocks_per_mcu), blocks[k]);
             }
         }
     }
 
     template <colors::color_type ColorType>
-    static auto encode(const Matrix<ColorType> &src) {
-        Matrix<int> Y(src.row(), src.col());
-        Matrix<int> Cb(src.row(), src.col());
-        Matrix<int> Cr(src.row(), src.col());
-
-        if constexpr (!std::same_as<ColorType, colors::YCbCr>) {
-            for (int i = 0; i < src.row(); i++) {
-                for (int j = 0; j < src.col(); j++) {
-                    const auto r = src[i, j].r;
-                    const auto g = src[i, j].g;
-                    const auto b = src[i, j].b;
-                    Y[i, j] = int(roundf(0.299f * r + 0.587f * g + 0.114f * b));
-                    Cb[i, j] = int(roundf(-0.168736f * r - 0.331364f * g + 0.5f * b + 128));
-                    Cr[i, j] = int(roundf(0.5f * r - 0.418688f * g - 0.081312f * b + 128));
+    static auto matrix_rows(const Matrix<ColorType> &src) {
+        return [&src](int i) {
+            return &src[i, 0];
+        };
+    }
+
+    // 算術編碼時寫 DAC 跟 SOF9, huffman_tables 不使用
+    static void write_headers(std::vector<std::byte> &buffer, int height, int width, const Jpeg_options &options,
+                              const Jpeg_huffman_tables &huffman_tables) {
+        const auto &tables = Jpeg_quant_tables::get(options.quality);
+        write_data<uint16_t, std::endian::big>(buffer, 0xFFD8u);
+        write_app0(buffer);
+        write_dqt(buffer, tables.luma.matrix, tables.chroma.matrix);
+        if (options.entropy == Jpeg_entropy::arithmetic) {
+            write_dac_segment(buffer);
+            write_sof_segment(buffer, height, width, 0xFFC9u);
+            return;
+        }
+        write_huffman_all(buffer, huffman_tables);
+        write_sof_segment(buffer, height, width);
+    }
+
+    static std::pair<std::unique_ptr<std::byte[]>, size_t> to_result(const std::vector<std::byte> &buffer) {
+        std::unique_ptr<std::byte[]> result(new std::byte[buffer.size()]);
+        std::copy(buffer.begin(), buffer.end(), result.get());
+        return {std::move(result), buffer.size()};
+    }
+
+    // 熵編碼前的 symbol 串流, 所有 block 接在同一個 vector 裡, 統計跟熵編碼都只是依序掃過去
+    // 每個 token 32 bit: 低 8 bit 是 huffman symbol (DC 是 category, AC 是 run << 4 | size), 往上是 amplitude
+    // block_begin[k] 是第 k 個 block (MCU 順序) 的 DC token 的位置, 後面接著它的 AC token
+    struct Token_stream {
+        std::vector<uint32_t> tokens;
+        std::vector<uint32_t> block_begin;
+        std::array<int, 3> last_dc{};
+
+        static constexpr uint32_t pack(uint32_t symbol, uint32_t amplitude) {
+            return symbol | amplitude << 8;
+        }
+
+        static constexpr uint8_t symbol(uint32_t token) {
+            return token & 0xFFu;
+        }
+
+        static constexpr uint32_t amplitude(uint32_t token) {
+            return token >> 8;
+        }
+
+        // 清空但保留已配置的記憶體
+        void clear() {
+            tokens.clear();
+            block_begin.clear();
+            last_dc = {};
+        }
+
+        // restart interval 的開頭, DC 重新從 0 開始預測
+        void reset_prediction() {
+            last_dc = {};
+        }
+
+        // 開頭是從 0 開始預測的, 改成接在 previous_dc (前一段的 last_dc) 後面, 只需要改每個 component 的第一個 DC
+        void rebase_prediction(const std::array<int, 3> &previous_dc) {
+            for (int component = 0; component < component_count; component++) {
+                auto &token = tokens[block_begin[component == 0 ? 0 : h_max * v_max + component - 1]];
+                const auto [size, value] = dc_to_size_value(dc_difference(token) - previous_dc[component]);
+                token = pack(size, value);
+            }
+        }
+
+        // 從 DC token 還原 DC 差
+        static int dc_difference(uint32_t token) {
+            return extend(amplitude(token), symbol(token));
+        }
+
+        // 還原一個 block 的 zigzag 係數, [0] 是 DC 差 (不是 DC 本身)
+        static block_t coefficients(std::span<const uint32_t> block_tokens) {
+            block_t block{};
+            block[0] = dc_difference(block_tokens[0]);
+            int k = 1;
+            for (const auto token : block_tokens.subspan(1)) {
+                const int run = symbol(token) >> 4;
+                const int size = symbol(token) & 0xF;
+                if (size == 0) {
+                    k += run == 15 ? 16 : 0;  // ZRL, EOB 一定是最後一個
+                    continue;
                 }
+                k += run;
+                block[k++] = extend(amplitude(token), size);
             }
-        } else {
-            for (int i = 0; i < src.row(); i++) {
-                for (int j = 0; j < src.col(); j++) {
-                    Y[i, j] = src[i, j].y;
-                    Cb[i, j] = src[i, j].cb;
-                    Cr[i, j] = src[i, j].cr;
+            return block;
+        }
+
+        // amplitude 還原成有號數 (T.81 F.2.2.1 EXTEND)
+        static int extend(uint32_t amplitude, int size) {
+            const int value = static_cast<int>(amplitude);
+            return size == 0 || value >> (size - 1) ? value : value - (1 << size) + 1;
+        }
+
+        // 回傳這個 block 的 token
+        std::span<const uint32_t> add_block(int component, const block_t &block) {
+            const auto begin = tokens.size();
+            block_begin.push_back(static_cast<uint32_t>(begin));
+            const auto [size, value] = dc_to_size_value(block[0] - last_dc[component]);
+            last_dc[component] = block[0];
+            Rle_tokens rle;
+            const int count = run_length_encode(block, rle);
+            tokens.resize(begin + 1 + count);
+            auto *out = tokens.data() + begin;
+            out[0] = pack(size, value);
+            for (int i = 0; i < count; i++) {
+                out[i + 1] = pack(rle[i].first, rle[i].second);
+            }
+            return {out, static_cast<std::size_t>(count) + 1};
+        }
+
+        std::size_t block_count() const {
+            return block_begin.size();
+        }
+
+        std::span<const uint32_t> block(std::size_t k) const {
+            const std::size_t end = k + 1 < block_begin.size() ? block_begin[k + 1] : tokens.size();
+            return {tokens.data() + block_begin[k], end - block_begin[k]};
+        }
+    };
+
+    // 寫出 Token_stream 裡的一個 block
+    static void write_tokens(Jpeg_bit_writer &bit_writer, int component, std::span<const uint32_t> block_tokens,
+                             const Jpeg_huffman_tables &tables) {
+        const auto &dc_table = component == 0 ? tables.y_dc : tables.uv_dc;
+        const auto &ac_table = component == 0 ? tables.y_ac : tables.uv_ac;
+        const auto dc_size = Token_stream::symbol(block_tokens[0]);
+        bit_writer.write_symbol(dc_table.getMapping(dc_size), Token_stream::amplitude(block_tokens[0]), dc_size);
+        for (const auto token : block_tokens.subspan(1)) {
+            const auto symbol = Token_stream::symbol(token);
+            bit_writer.write_symbol(ac_table.getMapping(symbol), Token_stream::amplitude(token), symbol & 0xFu);
+        }
+    }
+
+    // 依照 MCU 順序寫出整個 Token_stream
+    static void write_token_stream(Jpeg_bit_writer &bit_writer, const Token_stream &stream,
+                                   const Jpeg_huffman_tables &tables) {
+        for (std::size_t k = 0; k < stream.block_count(); k++) {
+            write_tokens(bit_writer, block_component(k % blocks_per_mcu), stream.block(k), tables);
+        }
+    }
+
+    // 算術編碼整個 Token_stream, DC 差已經算好了
+    static void write_token_stream(Jpeg_arithmetic_encoder &encoder, const Token_stream &stream) {
+        for (std::size_t k = 0; k < stream.block_count(); k++) {
+            const int component = block_component(k % blocks_per_mcu);
+            const auto block = Token_stream::coefficients(stream.block(k));
+            encoder.encode_block(component, component == 0 ? 0 : 1, block[0], block);
+        }
+    }
+
+    // 依照 MCU 順序累積 huffman 的 symbol 頻率
+    // 頻率存在固定大小的陣列, 建表只看頻率不看加入的順序, 結果跟標準函式庫的實作無關
+    struct Huffman_statistics {
+        Jpeg_huffman_frequencies frequencies;
+        std::array<int, 3> last_dc{};
+
+        void add_block(int component, const block_t &block) {
+            auto &dc = component == 0 ? frequencies.y_dc : frequencies.uv_dc;
+            auto &ac = component == 0 ? frequencies.y_ac : frequencies.uv_ac;
+            dc[category(block[0] - last_dc[component])]++;
+            last_dc[component] = block[0];
+            Rle_tokens tokens;
+            const int count = run_length_encode(block, tokens);
+            for (int i = 0; i < count; i++) {
+                ac[tokens[i].first]++;
+            }
+        }
+
+        // 跟 add_block 一樣, 但直接用 Token_stream::add_block 的結果
+        void add_tokens(int component, std::span<const uint32_t> block_tokens) {
+            auto &dc = component == 0 ? frequencies.y_dc : frequencies.uv_dc;
+            auto &ac = component == 0 ? frequencies.y_ac : frequencies.uv_ac;
+            dc[Token_stream::symbol(block_tokens[0])]++;
+            for (const auto token : block_tokens.subspan(1)) {
+                ac[Token_stream::symbol(token)]++;
+            }
+        }
+
+        void merge(const Huffman_statistics &other) {
+            merge_frequency(frequencies.y_dc, other.frequencies.y_dc);
+            merge_frequency(frequencies.y_ac, other.frequencies.y_ac);
+            merge_frequency(frequencies.uv_dc, other.frequencies.uv_dc);
+            merge_frequency(frequencies.uv_ac, other.frequencies.uv_ac);
+        }
+
+        Jpeg_huffman_tables build() const {
+            return Jpeg_huffman_tables::from_frequencies(frequencies);
+        }
+
+        // 用 tables 編碼統計到的 symbol 需要幾個 bit (huffman code 加上 amplitude), 不含 byte stuffing
+        std::size_t entropy_bits(const Jpeg_huffman_tables &tables) const {
+            return symbol_bits(frequencies.y_dc, tables.y_dc, true) +
+                   symbol_bits(frequencies.y_ac, tables.y_ac, false) +
+                   symbol_bits(frequencies.uv_dc, tables.uv_dc, true) +
+                   symbol_bits(frequencies.uv_ac, tables.uv_ac, false);
+        }
+
+    private:
+        static std::size_t symbol_bits(const std::array<uint32_t, 256> &counts, const Jpeg_huffman_table &table,
+                                       bool dc) {
+            std::size_t bits = 0;
+            for (int symbol = 0; symbol < 256; symbol++) {
+                if (counts[symbol] == 0) {
+                    continue;
                 }
+                const int amplitude_bits = dc ? symbol : symbol & 0xF;
+                bits += static_cast<std::size_t>(counts[symbol]) * (table.getMapping(symbol).length + amplitude_bits);
+            }
+            return bits;
+        }
+
+        static void merge_frequency(std::array<uint32_t, 256> &dst, const std::array<uint32_t, 256> &src) {
+            for (int symbol = 0; symbol < 256; symbol++) {
+                dst[symbol] += src[symbol];
             }
         }
+    };
 
-        std::vector<Matrix<int>> y_seq;
-        std::vector<Matrix<int>> cb_seq;
-        std::vector<Matrix<int>> cr_seq;
+    // 把一個量化後的 zigzag block 熵編碼, last_dc 是同一個 component 上一個 block 的 DC
+    static void encode_block(Jpeg_bit_writer &bit_writer, int component, const block_t &block,
+                             std::array<int, 3> &last_dc, const Jpeg_huffman_tables &tables) {
+        const auto &dc_table = component == 0 ? tables.y_dc : tables.uv_dc;
+        const auto &ac_table = component == 0 ? tables.y_ac : tables.uv_ac;
+        Rle_tokens tokens;
+        const int count = run_length_encode(block, tokens);
+        write_block(bit_writer, block[0] - last_dc[component], std::span(tokens.data(), count), dc_table, ac_table);
+        last_dc[component] = block[0];
+    }
 
-        if constexpr (sampling_type == Jpeg_sampling::ds_4_2_0) {
-            split<16>(Y)
-                .trans_convert([](const auto &mtx) {
-                    return split<8>(mtx);
-                })
-                .for_each([&y_seq](auto &mtx) {
-                    for (int i = 0; i < mtx.row(); i++) {
-                        for (int j = 0; j < mtx.col(); j++) {
-                            y_seq.emplace_back(std::move(mtx[i, j]));
-                        }
-                    }
+    // 跟上面一樣, 但用算術編碼, Y 用第 0 組統計, Cb Cr 共用第 1 組
+    static void encode_block(Jpeg_arithmetic_encoder &encoder, int component, const block_t &block,
+                             std::array<int, 3> &last_dc) {
+        encoder.encode_block(component, component == 0 ? 0 : 1, block[0] - last_dc[component], block);
+        last_dc[component] = block[0];
+    }
+
+    // 一個 restart interval 的 token (MCU 順序) 跟它自己的 huffman 統計
+    struct Restart_interval {
+        Token_stream tokens;
+        Huffman_statistics statistics;
+        std::vector<std::byte> bytes;
+    };
+
+    // Jpeg_huffman::sampled 的表: 每 huffman_sample_rows 個 MCU row 只統計第一列
+    // 取樣的 row 之間 DC 直接接著預測, 跟實際的 DC 差不完全一樣, 反正每個 symbol 都會補上 code
+    template <Jpeg_stripe_source FetchRow>
+    static Jpeg_huffman_tables sampled_tables(int height, int width, FetchRow &fetch_row, const Jpeg_options &options) {
+        const int step = std::max(options.huffman_sample_rows, 1);
+        Mcu_stripe stripe;
+        std::vector<block_t> blocks;
+        Huffman_statistics statistics;
+        for (int mcu_row = 0; mcu_row < mcu_row_count(height); mcu_row += step) {
+            for_each_dct_block(height, width, mcu_row, mcu_row + 1, fetch_row, options, stripe, blocks,
+                               [&](int component, block_t &block) {
+                                   statistics.add_block(component, quantize_block(block, component, options));
+                               });
+        }
+        statistics.frequencies.cover_all_symbols(component_count == 3);
+        return statistics.build();
+    }
+
+    // 每個 interval 在各自的執行緒上轉換、統計、熵編碼, 最後依序接起來並在中間插入 RSTn
+    // 使用標準或取樣的 huffman 表時表已經先決定好, 轉換完直接熵編碼, 不需要保留 token
+    // 算術編碼在每個 interval 開頭本來就重新開始統計, 同樣直接編碼
+    // fetch_row 會被多個執行緒同時呼叫
+    template <Jpeg_stripe_source FetchRow>
+    static std::pair<std::unique_ptr<std::byte[]>, size_t> write_restart(int height, int width, FetchRow &&fetch_row,
+                                                                         const Jpeg_options &options) {
+        const int mcu_rows = mcu_row_count(height);
+        const int mcus_per_row = align<mcu_width>(width) / mcu_width;
+        const int rows_per_interval = std::min(options.restart_rows, mcu_rows);
+        if (rows_per_interval * mcus_per_row > 0xFFFF) {
+            throw std::invalid_argument("restart interval is larger than 65535 MCUs");
+        }
+        const int interval_count = (mcu_rows + rows_per_interval - 1) / rows_per_interval;
+        const bool arithmetic = options.entropy == Jpeg_entropy::arithmetic;
+        const bool one_pass = arithmetic || options.huffman != Jpeg_huffman::optimized;
+        Jpeg_huffman_tables tables = !arithmetic && options.huffman == Jpeg_huffman::sampled
+                                         ? sampled_tables(height, width, fetch_row, options)
+                                         : Jpeg_huffman_tables::standard();
+        std::vector<Restart_interval> intervals(interval_count);
+
+        parallel_for(interval_count, options.threads, [&](int index) {
+            auto &interval = intervals[index];
+            const int begin = index * rows_per_interval;
+            const int end = std::min(begin + rows_per_interval, mcu_rows);
+            if (arithmetic) {
+                Jpeg_arithmetic_encoder encoder(interval.bytes);
+                std::array<int, 3> last_dc{};
+                for_each_block(height, width, begin, end, fetch_row, options, [&](int component, const auto &block) {
+                    encode_block(encoder, component, block, last_dc);
                 });
-            split<16>(Cb).for_each([&cb_seq](auto &&mtx) {
-                cb_seq.push_back(down_sample(mtx));
-            });
-            split<16>(Cr).for_each([&cr_seq](auto &&mtx) {
-                cr_seq.push_back(down_sample(mtx));
-            });
-        } else {
-            split<8>(Y).for_each([&y_seq](auto &mtx) {
-                y_seq.push_back(std::move(mtx));
-            });
-            split<8>(Cb).for_each([&cb_seq](auto &mtx) {
-                cb_seq.push_back(std::move(mtx));
+                encoder.finish();
+                return;
+            }
+            if (one_pass) {
+                Jpeg_bit_writer bit_writer(interval.bytes);
+                std::array<int, 3> last_dc{};
+                for_each_block(height, width, begin, end, fetch_row, options, [&](int component, const auto &block) {
+                    encode_block(bit_writer, component, block, last_dc, tables);
+                });
+                bit_writer.flush();
+                return;
+            }
+            interval.tokens.block_begin.reserve((end - begin) * mcus_per_row * blocks_per_mcu);
+            for_each_block(height, width, begin, end, fetch_row, options, [&](int component, const auto &block) {
+                interval.statistics.add_tokens(component, interval.tokens.add_block(component, block));
             });
-            split<8>(Cr).for_each([&cr_seq](auto &mtx) {
-                cr_seq.push_back(std::move(mtx));
+        });
+
+        if (!one_pass) {
+            // 依照 interval 的順序合併, 所以 huffman 表跟執行緒數無關
+            Huffman_statistics statistics;
+            for (const auto &interval : intervals) {
+                statistics.merge(interval.statistics);
+            }
+            tables = statistics.build();
+
+            parallel_for(interval_count, options.threads, [&](int index) {
+                auto &interval = intervals[index];
+                Jpeg_bit_writer bit_writer(interval.bytes);
+                write_token_stream(bit_writer, interval.tokens, tables);
+                bit_writer.flush();
+                interval.tokens = {};
             });
         }
 
-        std::vector<std::vector<int32_t>> dcs;
-        std::vector<std::vector<std::vector<std::pair<uint8_t, int>>>> acs;
-        for (const auto seq_ptr : {&y_seq, &cb_seq, &cr_seq}) {
-            auto &seq = *seq_ptr;
-
-            /* clang-format off */
-            auto zigzaged = seq
-                | std::views::transform([](Matrix<int> &block) {
-                    block.transform([](int &x) {
-                        x -= 128;
-                    });
-                    return block;
-                })
-                | std::views::transform(Dct<8>::dct<int, int>)
-                | std::views::transform([seq_ptr, y_ptr = &y_seq](const Matrix<int> &block) {
-                    if (seq_ptr == y_ptr) {
-                        return block.round_div_convert(y_quantization_matrix);
+        std::vector<std::byte> buffer;
+        write_headers(buffer, height, width, options, tables);
+        write_dri_segment(buffer, rows_per_interval * mcus_per_row);
+        write_sos_header(buffer);
+        for (int index = 0; index < interval_count; index++) {
+            if (index > 0) {
+                write_data<uint16_t, std::endian::big>(buffer, 0xFFD0u + (index - 1) % 8);  // RSTn
+            }
+            buffer.insert(buffer.end(), intervals[index].bytes.begin(), intervals[index].bytes.end());
+        }
+        write_data<uint16_t, std::endian::big>(buffer, static_cast<uint16_t>(0xFFD9u));
+        return to_result(buffer);
+    }
+
+    // 一個 component 量化後的 zigzag block, 大小補齊到 MCU 的倍數
+    struct Coefficient_plane {
+        int blocks_width = 0, blocks_height = 0;
+        std::vector<block_t> blocks;
+
+        Coefficient_plane(int blocks_width, int blocks_height)
+            : blocks_width(blocks_width), blocks_height(blocks_height), blocks(blocks_width * blocks_height) {}
+
+        block_t &at(int i, int j) {
+            return blocks[i * blocks_width + j];
+        }
+    };
+
+    // 轉換整張圖, 依照 block 的位置存到各 component 的 Coefficient_plane
+    template <Jpeg_stripe_source FetchRow>
+    static std::array<Coefficient_plane, 3> transform_planes(int height, int width, FetchRow &&fetch_row,
+                                                             const Jpeg_options &options) {
+        const int mcu_rows = mcu_row_count(height);
+        const int mcus_per_row = align<mcu_width>(width) / mcu_width;
+        // 灰階沒有 Cb Cr, 留空的 plane
+        const int chroma_width = component_count == 3 ? mcus_per_row : 0;
+        const int chroma_height = component_count == 3 ? mcu_rows : 0;
+        std::array<Coefficient_plane, 3> planes = {
+            Coefficient_plane(mcus_per_row * h_max, mcu_rows * v_max),
+            Coefficient_plane(chroma_width, chroma_height),
+            Coefficient_plane(chroma_width, chroma_height),
+        };
+        int index = 0;
+        for_each_block(height, width, fetch_row, options, [&](int component, const auto &block) {
+            const int mcu = index / blocks_per_mcu;
+            const int index_in_mcu = index % blocks_per_mcu;
+            const int mcu_i = mcu / mcus_per_row, mcu_j = mcu % mcus_per_row;
+            if (component == 0) {
+                planes[0].at(mcu_i * v_max + index_in_mcu / h_max, mcu_j * h_max + index_in_mcu % h_max) = block;
+            } else {
+                planes[component].at(mcu_i, mcu_j) = block;
+            }
+            index++;
+        });
+        return planes;
+    }
+
+    // 依照 scan 的順序走過每個 block (T.81 A.2)
+    // 多個 component 的 scan 是交錯的, 以 MCU 為單位; 單一 component 的 scan 不交錯,
+    // 只走 component 本身解析度涵蓋的 block, 不包含 MCU 補齊的部分
+    template <typename OnBlock>
+    static void for_each_scan_block(const Jpeg_scan &scan, int height, int width,
+                                    std::array<Coefficient_plane, 3> &planes, OnBlock &&on_block) {
+        if (scan.components.size() == 1) {
+            const int component = scan.components[0];
+            const int h = component == 0 ? h_max : 1;
+            const int v = component == 0 ? v_max : 1;
+            const int component_width = (width * h + h_max - 1) / h_max;
+            const int component_height = (height * v + v_max - 1) / v_max;
+            auto &plane = planes[component];
+            for (int i = 0; i < (component_height + 7) / 8; i++) {
+                for (int j = 0; j < (component_width + 7) / 8; j++) {
+                    on_block(component, plane.at(i, j));
+                }
+            }
+            return;
+        }
+        for (int mcu_i = 0; mcu_i < planes[1].blocks_height; mcu_i++) {
+            for (int mcu_j = 0; mcu_j < planes[1].blocks_width; mcu_j++) {
+                for (const int component : scan.components) {
+                    if (component != 0) {
+                        on_block(component, planes[component].at(mcu_i, mcu_j));
+                        continue;
                     }
-                    return block.round_div_convert(uv_quantization_matrix);
-                })
-                | std::views::transform([](const Matrix<int> &block) {
-                    // zig zag 排列
-                    // 忽略 uninitialize error 因為每個 index 都會填東西
-                    std::array<int, 8 * 8> block_zig;  // NOLINT(*-pro-type-member-init)
-                    int index = 0;
-                    for (const auto &[i, j]: zigzag<8>()) {
-                        block_zig[index++] = block[i, j];
+                    for (int i = 0; i < v_max; i++) {
+                        for (int j = 0; j < h_max; j++) {
+                            on_block(component, planes[0].at(mcu_i * v_max + i, mcu_j * h_max + j));
+                        }
                     }
-                    return block_zig;
-                })
-                | std::ranges::to<std::vector>();
-            /* clang-format on */
-            std::vector<int32_t> dc(zigzaged.size());
-            for (int i = 0; i < zigzaged.size(); i++) {
-                if (i == 0) {
-                    dc[i] = zigzaged[i][0];
-                } else {
-                    dc[i] = zigzaged[i][0] - zigzaged[i - 1][0];
                 }
             }
+        }
+    }
+
+    // 每個 scan 自己的 DHT, 表 0 給 Y, 表 1 給 Cb Cr
+    static void write_scan_huffman(std::vector<std::byte> &buffer, const Jpeg_scan &scan,
+                                   const std::array<Jpeg_huffman_table, 2> &tables) {
+        write_data<uint16_t, std::endian::big>(buffer, 0xFFC4u);
+        int size_index = buffer.size();
+        buffer.resize(buffer.size() + 2);
+        const uint8_t table_class = scan.ss == 0 ? 0 : 1;  // [DC : 0  ac : 1 ; ID]
+        for (int id = 0; id < 2; id++) {
+            const bool used = std::ranges::any_of(scan.components, [id](int component) {
+                return (component == 0 ? 0 : 1) == id;
+            });
+            if (used) {
+                write_data<uint8_t>(buffer, table_class << 4 | id);
+                write_huffman_data(buffer, tables[id]);
+            }
+        }
+        write_byte<uint16_t, std::endian::big>(&buffer[size_index], buffer.size() - size_index);  // 填入 size
+    }
+
+    static void write_scan_sos_header(std::vector<std::byte> &buffer, const Jpeg_scan &scan) {
+        write_data<uint16_t, std::endian::big>(buffer, 0xFFDAu);
+        int size_index = buffer.size();
+        buffer.resize(buffer.size() + 2);
+        write_data<uint8_t>(buffer, scan.components.size());
+        for (const int component : scan.components) {
+            const uint8_t id = component == 0 ? 0 : 1;
+            write_data<uint8_t>(buffer, component + 1);  // component ID
+            write_data<uint8_t>(buffer, id << 4 | id);   // DC / AC huffman id
+        }
+        write_data<uint8_t>(buffer, scan.ss);
+        write_data<uint8_t>(buffer, scan.se);
+        write_data<uint8_t>(buffer, scan.ah << 4 | scan.al);
+        write_byte<uint16_t, std::endian::big>(&buffer[size_index], buffer.size() - size_index);  // 填入 size
+    }
+
+    // progressive: 先把整張圖轉換、量化存起來, 之後每個 scan 各跑兩趟, 第一趟統計 huffman, 第二趟寫出
+    template <Jpeg_stripe_source FetchRow>
+    static std::pair<std::unique_ptr<std::byte[]>, size_t> write_progressive(int height, int width,
+                                                                             FetchRow &&fetch_row,
+                                                                             const Jpeg_options &options) {
+        Jpeg_scan::validate_script(options.scans, component_count);
+        auto planes = transform_planes(height, width, fetch_row, options);
+
+        const auto &quant_tables = Jpeg_quant_tables::get(options.quality);
+        std::vector<std::byte> buffer;
+        write_data<uint16_t, std::endian::big>(buffer, 0xFFD8u);
+        write_app0(buffer);
+        write_dqt(buffer, quant_tables.luma.matrix, quant_tables.chroma.matrix);
+        write_sof_segment(buffer, height, width, 0xFFC2u);
+
+        for (const auto &scan : options.scans) {
+            auto for_each_block_in_scan = [&](auto &encoder) {
+                for_each_scan_block(scan, height, width, planes, [&](int component, const block_t &block) {
+                    encoder.encode(component, block);
+                });
+                encoder.finish();
+            };
+
+            std::array<Jpeg_huffman_table, 2> tables;
+            // DC 的 refine scan 每個 block 只送一個 bit, 不需要 huffman 表
+            if (scan.ss > 0 || scan.ah == 0) {
+                Jpeg_scan_statistics statistics;
+                Jpeg_scan_encoder counter(scan, statistics);
+                for_each_block_in_scan(counter);
+                tables = statistics.build();
+                write_scan_huffman(buffer, scan, tables);
+            }
+            write_scan_sos_header(buffer, scan);
 
-            auto ac = zigzaged | std::views::transform(calculate_rle) | std::ranges::to<std::vector>();
+            Jpeg_bit_writer bit_writer(buffer);
+            Jpeg_scan_writer writer{bit_writer, tables};
+            Jpeg_scan_encoder encoder(scan, writer);
+            for_each_block_in_scan(encoder);
+            bit_writer.flush();
+        }
+        write_data<uint16_t, std::endian::big>(buffer, static_cast<uint16_t>(0xFFD9u));
+        return to_result(buffer);
+    }
 
-            dcs.emplace_back(std::move(dc));
-            acs.emplace_back(std::move(ac));
+    // write() 跟 write_yuv() 共用, 依 options 選擇輸出方式
+    template <Jpeg_stripe_source FetchRow>
+    static std::pair<std::unique_ptr<std::byte[]>, size_t> write_source(int height, int width, FetchRow &&fetch_row,
+                                                                        const Jpeg_options &options) {
+        const bool arithmetic = options.entropy == Jpeg_entropy::arithmetic;
+        if (!options.scans.empty()) {
+            if (arithmetic) {
+                throw std::invalid_argument("arithmetic coding only supports sequential JPEG");
+            }
+            return write_progressive(height, width, fetch_row, options);
+        }
+        if (options.restart_rows > 0) {
+            return write_restart(height, width, fetch_row, options);
+        }
+        // 熵編碼以前 (色彩轉換 -> DCT -> 量化 -> RLE) 每個 MCU row 互不相依
+        // 切成幾段 MCU row, 由 options.threads 個執行緒搶著做, 每段各自變成 token, DC 先從 0 開始預測
+        // 之後依序把每段開頭的 DC 差接回前一段, 再照 MCU 順序統計跟熵編碼, 輸出跟執行緒數無關
+        // 算術編碼和固定表 (standard / sampled) 不用統計, 只有一個執行緒時直接串流編碼, 不保留 token
+        const int mcu_rows = mcu_row_count(height);
+        const int thread_count = std::min(resolve_thread_count(options.threads), mcu_rows);
+        const bool fixed_tables = arithmetic || options.huffman != Jpeg_huffman::optimized;
+        if (fixed_tables && thread_count <= 1) {
+            return write_streaming(height, width, fetch_row, options);
+        }
+        // 段數比執行緒多, 比較慢的段不會拖住其他執行緒
+        const int chunk_count = thread_count > 1 ? std::min(mcu_rows, thread_count * 4) : 1;
+        const int mcus_per_row = align<mcu_width>(width) / mcu_width;
+        std::vector<Token_stream> chunks(chunk_count);
+        parallel_for(chunk_count, thread_count, [&](int index) {
+            const int begin = mcu_rows * index / chunk_count;
+            const int end = mcu_rows * (index + 1) / chunk_count;
+            auto &stream = chunks[index];
+            stream.block_begin.reserve(static_cast<std::size_t>(end - begin) * mcus_per_row * blocks_per_mcu);
+            for_each_block(height, width, begin, end, fetch_row, options,
+                           [&](int component, const auto &block) {
+                               stream.add_block(component, block);
+                           });
+        });
+
+        for (std::size_t index = 1; index < chunks.size(); index++) {
+            chunks[index].rebase_prediction(chunks[index - 1].last_dc);
+        }
+        std::vector<std::byte> buffer;
+        if (arithmetic) {
+            write_headers(buffer, height, width, options, {});
+            write_sos_header(buffer);
+            Jpeg_arithmetic_encoder encoder(buffer);
+            for (const auto &stream : chunks) {
+                write_token_stream(encoder, stream);
+            }
+            encoder.finish();
+            write_data<uint16_t, std::endian::big>(buffer, static_cast<uint16_t>(0xFFD9u));
+            return to_result(buffer);
+        }
+
+        Jpeg_huffman_tables tables;
+        if (options.huffman == Jpeg_huffman::standard) {
+            tables = Jpeg_huffman_tables::standard();
+        } else if (options.huffman == Jpeg_huffman::sampled) {
+            tables = sampled_tables(height, width, fetch_row, options);
+        } else {
+            Huffman_statistics statistics;
+            for (std::size_t index = 0; index < chunks.size(); index++) {
+                for (std::size_t k = 0; k < chunks[index].block_count(); k++) {
+                    statistics.add_tokens(block_component(k % blocks_per_mcu), chunks[index].block(k));
+                }
+            }
+            tables = statistics.build();
         }
 
-        return std::tuple{std::move(dcs), std::move(acs)};
+        write_headers(buffer, height, width, options, tables);
+        write_sos_header(buffer);
+        Jpeg_bit_writer bit_writer(buffer);
+        for (const auto &stream : chunks) {
+            write_token_stream(bit_writer, stream, tables);
+        }
+        bit_writer.flush();
+        write_data<uint16_t, std::endian::big>(buffer, static_cast<uint16_t>(0xFFD9u));
+        return to_result(buffer);
     }
 
 public:
     template <colors::color_type ColorType>
-    static std::pair<std::unique_ptr<std::byte[]>, size_t> write(const Matrix<ColorType> &src) {
-        auto [dcs, acs] = encode(src);
-        auto [y_dc, y_ac, uv_dc, uv_ac] = build_huffman_tree(dcs, acs);
+    static std::pair<std::unique_ptr<std::byte[]>, size_t> write(const Matrix<ColorType> &src,
+                                                                 const Jpeg_options &options = {}) {
+        return write_source(src.row(), src.col(), matrix_rows(src), options);
+    }
+
+    // 直接編碼 YUV 平面 (例如影片解碼出來的 frame), 跳過色彩轉換, I420 / NV12 也跳過 Cb Cr 的減半
+    // I420 / NV12 只能用 ds_4_2_0, YUV444 只能用 ds_4_4_4, grayscale 只讀 Y, 其他組合丟出 std::invalid_argument
+    // options 跟 write() 一樣, 平面在有多個執行緒時會被同時讀取
+    static std::pair<std::unique_ptr<std::byte[]>, size_t> write_yuv(const Jpeg_yuv_planes &planes,
+                                                                     const Jpeg_options &options = {}) {
+        validate_yuv_planes(planes);
+        return write_source(planes.height, planes.width, planes, options);
+    }
+
+    // 串流模式: 每次只從 fetch_row 拉一個 MCU row (8 或 16 列) 做色彩轉換 -> DCT -> 量化 -> 熵編碼
+    // 不會保留整張圖的中間資料, 工作記憶體只跟寬度有關
+    // 統計 huffman 時第一趟只統計頻率, 第二趟重新轉換並輸出, 所以 fetch_row 會被呼叫兩輪
+    // 使用標準 huffman 表或算術編碼時只有一趟, 取樣統計時第一趟只讀取樣的 MCU row
+    // fetch_row 也可以是 Jpeg_yuv_planes, 不過一般應該用 write_yuv, 會先檢查平面
+    template <Jpeg_stripe_source FetchRow>
+    static std::pair<std::unique_ptr<std::byte[]>, size_t> write_streaming(int height, int width, FetchRow &&fetch_row,
+                                                                           const Jpeg_options &options = {}) {
+        if (options.entropy == Jpeg_entropy::arithmetic) {
+            std::vector<std::byte> buffer;
+            write_headers(buffer, height, width, options, {});
+            write_sos_header(buffer);
+            Jpeg_arithmetic_encoder encoder(buffer);
+            std::array<int, 3> last_dc{};
+            for_each_block(height, width, fetch_row, options, [&](int component, const auto &block) {
+                encode_block(encoder, component, block, last_dc);
+            });
+            encoder.finish();
+            write_data<uint16_t, std::endian::big>(buffer, static_cast<uint16_t>(0xFFD9u));
+            return to_result(buffer);
+        }
+
+        Jpeg_huffman_tables tables = Jpeg_huffman_tables::standard();
+        if (options.huffman == Jpeg_huffman::optimized) {
+            Huffman_statistics statistics;
+            for_each_block(height, width, fetch_row, options, [&](int component, const auto &block) {
+                statistics.add_block(component, block);
+            });
+            tables = statistics.build();
+        } else if (options.huffman == Jpeg_huffman::sampled) {
+            tables = sampled_tables(height, width, fetch_row, options);
+        }
+
         std::vector<std::byte> buffer;
-        write_data<uint16_t, std::endian::big>(buffer, 0xFFD8u);
-        write_app0(buffer);
-        write_dqt(buffer, y_quantization_matrix, uv_quantization_matrix);
-        write_huffman_all(buffer, y_dc, y_ac, uv_dc, uv_ac);
-        write_sof0_segment(buffer, src.row(), src.col());
-        write_binary_stream(buffer, y_dc, y_ac, uv_dc, uv_ac, dcs, acs);
+        write_headers(buffer, height, width, options, tables);
+        write_sos_header(buffer);
 
-        std::unique_ptr<std::byte[]> result(new std::byte[buffer.size()]);
-        std::copy(buffer.begin(), buffer.end(), result.get());
-        return {std::move(result), buffer.size()};
+        Jpeg_bit_writer bit_writer(buffer);
+        std::array<int, 3> last_dc{};
+        for_each_block(height, width, fetch_row, options, [&](int component, const auto &block) {
+            encode_block(bit_writer, component, block, last_dc, tables);
+        });
+        bit_writer.flush();
+        write_data<uint16_t, std::endian::big>(buffer, static_cast<uint16_t>(0xFFD9u));
+        return to_result(buffer);
     }
 
-    template <typename T>
-    static std::pair<std::unique_ptr<std::byte[]>, size_t> exportToByte(const Matrix<T> &src) {
-        return write(src);
+    template <colors::color_type ColorType>
+    static std::pair<std::unique_ptr<std::byte[]>, size_t> write_streaming(const Matrix<ColorType> &src,
+                                                                           const Jpeg_options &options = {}) {
+        return write_streaming(src.row(), src.col(), matrix_rows(src), options);
     }
 
-private:
-    template <int N, int M = N, typename T>
-    static Matrix<Matrix<T>> split(const Matrix<T> &mtx) {
-        const int row_sz = mtx.row() / N + int(mtx.row() % N != 0);
-        const int col_sz = mtx.col() / M + int(mtx.col() % M != 0);
-        Matrix<Matrix<T>> result(row_sz, col_sz);
-        for (int i = 0; i < row_sz; i++) {
-            for (int j = 0; j < col_sz; j++) {
-                Matrix<T> block(N, M);
-                for (int k = 0; k < N; k++) {
-                    for (int l = 0; l < M; l++) {
-                        if (i * N + k >= mtx.row() || j * M + l >= mtx.col()) [[unlikely]] {
-                            int new_h = std::min(i * N + k, mtx.row() - 1);
-                            int new_w = std::min(j * M + l, mtx.col() - 1);
-                            block[k, l] = mtx[new_h, new_w];
-                        } else {
-                            block[k, l] = mtx[i * N + k, j * M + l];
-                        }
-                    }
+    // 在 max_bytes 以內用最高的 quality (1 ~ 100) 編碼, options.quality 會被忽略
+    // 色彩轉換跟 DCT 只做一次, 之後對保留下來的係數二分搜尋 quality, 每次只重做量化跟 huffman 統計來估算大小
+    // 連 quality 1 都超過 max_bytes 時回傳 quality 1 的結果
+    // 算術編碼時一樣用 huffman 的大小估算, 實際輸出通常更小, 選到的 quality 可能比做得到的低一點
+    template <colors::color_type ColorType>
+    static std::pair<std::unique_ptr<std::byte[]>, size_t> write_to_size(const Matrix<ColorType> &src,
+                                                                         std::size_t max_bytes,
+                                                                         const Jpeg_options &options = {}) {
+        if (!options.scans.empty() || options.restart_rows > 0) {
+            throw std::invalid_argument("write_to_size only supports baseline output without restart intervals");
+        }
+        const int height = src.row(), width = src.col();
+        const int mcu_rows = mcu_row_count(height);
+        // MCU 順序, 還沒量化的 DCT 係數
+        std::vector<block_t> coefficients;
+        coefficients.reserve(mcu_rows * (align<mcu_width>(width) / mcu_width) * blocks_per_mcu);
+        for_each_dct_block(height, width, 0, mcu_rows, matrix_rows(src), options, [&](int, const block_t &block) {
+            coefficients.push_back(block);
+        });
+
+        Jpeg_options trial = options;
+        auto quantize_all = [&](int quality, auto &&on_block) {
+            trial.quality = quality;
+            for (std::size_t k = 0; k < coefficients.size(); k++) {
+                const int component = block_component(k % blocks_per_mcu);
+                block_t block = coefficients[k];
+                on_block(component, quantize_block(block, component, trial));
+            }
+        };
+        auto build_tables = [&](Huffman_statistics &statistics) {
+            return options.huffman == Jpeg_huffman::standard ? Jpeg_huffman_tables::standard() : statistics.build();
+        };
+        auto estimate_size = [&](int quality) {
+            Huffman_statistics statistics;
+            quantize_all(quality, [&](int component, const block_t &block) {
+                statistics.add_block(component, block);
+            });
+            const auto tables = build_tables(statistics);
+            std::vector<std::byte> headers;
+            write_headers(headers, height, width, trial, tables);
+            write_sos_header(headers);
+            return headers.size() + (statistics.entropy_bits(tables) + 7) / 8 + 2;  // + EOI
+        };
+
+        // quality 越高檔案越大, 找估算值不超過 max_bytes 的最大 quality
+        int low = 1, high = 100;
+        while (low < high) {
+            const int mid = (low + high + 1) / 2;
+            if (estimate_size(mid) <= max_bytes) {
+                low = mid;
+            } else {
+                high = mid - 1;
+            }
+        }
+
+        // 估算沒有包含 0xFF 後面補的 0x00, 實際寫出來超過的話再往下降
+        std::vector<block_t> quantized;
+        quantized.reserve(coefficients.size());
+        for (int quality = low;; quality--) {
+            Huffman_statistics statistics;
+            quantized.clear();
+            quantize_all(quality, [&](int component, const block_t &block) {
+                statistics.add_block(component, block);
+                quantized.push_back(block);
+            });
+            const auto tables = build_tables(statistics);
+
+            std::vector<std::byte> buffer;
+            write_headers(buffer, height, width, trial, tables);
+            write_sos_header(buffer);
+            std::array<int, 3> last_dc{};
+            if (options.entropy == Jpeg_entropy::arithmetic) {
+                Jpeg_arithmetic_encoder encoder(buffer);
+                for (std::size_t k = 0; k < quantized.size(); k++) {
+                    encode_block(encoder, block_component(k % blocks_per_mcu), quantized[k], last_dc);
                 }
-                result[i, j] = std::move(block);
+                encoder.finish();
+            } else {
+                Jpeg_bit_writer bit_writer(buffer);
+                for (std::size_t k = 0; k < quantized.size(); k++) {
+                    encode_block(bit_writer, block_component(k % blocks_per_mcu), quantized[k], last_dc, tables);
+                }
+                bit_writer.flush();
+            }
+            write_data<uint16_t, std::endian::big>(buffer, static_cast<uint16_t>(0xFFD9u));
+            if (buffer.size() <= max_bytes || quality == 1) {
+                return to_result(buffer);
             }
         }
-        return result;
     }
 
     template <typename T>
-    static Matrix<T> down_sample(const Matrix<T> &mtx) {
-        Matrix<T> result(8, 8);
-        for (int i = 0; i < 8; i++) {
-            for (int j = 0; j < 8; j++) {
-                auto sum =
-                    mtx[i * 2, j * 2] + mtx[i * 2 + 1, j * 2] + mtx[i * 2, j * 2 + 1] + mtx[i * 2 + 1, j * 2 + 1];
-                result[i, j] = sum / 4;
-            }
-        }
-        return result;
+    static std::pair<std::unique_ptr<std::byte[]>, size_t> exportToByte(const Matrix<T> &src) {
+        return write(src);
+    }
+
+    // 解 baseline (SOF0 / SOF1) 的 JPEG, 輸出 BGR
+    static Midway importFromByte(const std::byte *source) {
+        return Jpeg_decoder::decode(source);
     }
 
+    static Midway importFromByte(const std::byte *source, std::size_t size,
+                                 const Jpeg_decode_options &options = {}) {
+        return Jpeg_decoder::decode(source, size, options);
+    }
+
+    // 不經過 pixel 的無損旋轉 / 鏡像 / 裁切, 輸入是 baseline JPEG
+    static std::pair<std::unique_ptr<std::byte[]>, size_t> transform(const std::byte *source, std::size_t size,
+                                                                     const Jpeg_transform_options &options) {
+        return Jpeg_transformer::transform(source, size, options);
+    }
+
+private:
     template <typename int_type>
     static uint8_t calculate_binary_size(int_type x) {
         [[assume(x > 0)]];
@@ -576,107 +1382,59 @@ private:
         return calculate_binary_size(x);
     }
 
-    constexpr static uint32_t to_amplitude(int val, int size) {
-        if (val > 0) {
-            return val;
+    // bit i 代表 arr[i] 不是 0, 不含 DC (bit 0 一定是 0)
+    static uint64_t nonzero_ac_mask(const std::array<int, 8 * 8> &arr) {
+        uint64_t mask = 0;
+#ifdef __AVX2__
+        const auto zero = _mm256_setzero_si256();
+        for (int k = 0; k < 8; k++) {
+            const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(arr.data() + k * 8));
+            const auto is_zero = _mm256_castsi256_ps(_mm256_cmpeq_epi32(v, zero));
+            mask |= static_cast<uint64_t>(~_mm256_movemask_ps(is_zero) & 0xFF) << (k * 8);
         }
-        return (1u << size) - 1 - std::abs(val);
+#else
+        for (int i = 0; i < 64; i++) {
+            mask |= static_cast<uint64_t>(arr[i] != 0) << i;
+        }
+#endif
+        return mask & ~uint64_t{1};
     }
 
-    static std::vector<std::pair<uint8_t, int>> calculate_rle(const std::array<int, 8 * 8> &arr) {
-        // run length encoding
-        std::vector<std::pair<uint8_t, int>> rle;
-        int last_non_zero = 0;
-        for (int i = arr.size() - 1; i >= 0; i--) {
-            if (arr[i] != 0) {
-                last_non_zero = i;
-                break;
+public:
+    // 一個 block 最多 63 個 AC symbol
+    using Rle_tokens = std::array<std::pair<uint8_t, int>, 64>;
+
+    // 把 zigzag 排列的 block 的 AC 轉成 (run << 4 | size, amplitude), 寫進呼叫端給的陣列, 回傳 symbol 個數
+    // 用非 0 係數的 bit mask 直接跳到下一個非 0 的位置, 全部是 0 時只有 EOB
+    static int run_length_encode(const std::array<int, 8 * 8> &arr, Rle_tokens &rle) {
+        uint64_t mask = nonzero_ac_mask(arr);
+        if (mask == 0) {
+            rle[0] = {0x00, 0};  // EOB
+            return 1;
+        }
+        int count = 0;
+        int previous = 0;
+        // 最後一個係數不是 0 時不需要 EOB, 先決定好
+        const bool end_of_block = (mask >> 63) == 0;
+        while (mask != 0) {
+            const int i = std::countr_zero(mask);
+            mask &= mask - 1;
+            int run = i - previous - 1;
+            previous = i;
+            for (; run >= 16; run -= 16) {
+                rle[count++] = {0xF0, 0};  // ZRL
             }
+            // size = |v| 的 bit 數, 負數的 amplitude 是 v - 1 的低 size 個 bit
+            const int value = arr[i];
+            const int sign = value >> 31;
+            const int size = std::bit_width(static_cast<uint32_t>((value ^ sign) - sign));
+            rle[count++] = {static_cast<uint8_t>(run << 4 | size), (value + sign) & ((1 << size) - 1)};
         }
-        int cnt = 0;
-        for (int i = 1; i <= last_non_zero; i++) {
-            if (arr[i] != 0 || cnt == 15) {
-                // [run_len, size_for_bit], amp
-                if (arr[i] == 0) {
-                    rle.emplace_back(0xF0, 0);
-                } else {
-                    const uint8_t size_for_bit = calculate_binary_size(std::abs(arr[i]));
-                    rle.emplace_back(unsigned(cnt) << 4u | size_for_bit, to_amplitude(arr[i], size_for_bit));
-                }
-                cnt = 0;
-            } else {  // cnt < 15 and arr[i] == 0
-                cnt++;
-            }
-        }
-        if (arr.back() == 0) {
-            rle.emplace_back(0x00, 0);  // EOB -- end of block
-        }
-        if (rle.size() > 63) {
-            throw std::runtime_error("...");
-        }
-        return rle;
-    }
-
-    // constexpr static std::array<std::array<uint8_t, 8>, 8> y_quantization_matrix = {
-    //     std::array<uint8_t, 8>{16, 11, 10, 16, 24, 40, 51, 61},
-    //     {12, 12, 14, 19, 26, 58, 60, 55},
-    //     {14, 13, 16, 24, 40, 57, 69, 56},
-    //     {14, 17, 22, 29, 51, 87, 80, 62},
-    //     {18, 22, 37, 56, 68, 109, 103, 77},
-    //     {24, 35, 55, 64, 81, 104, 113, 92},
-    //     {49, 64, 78, 87, 103, 121, 120, 101},
-    //     {72, 92, 95, 98, 112, 100, 103, 99}};
-
-    /*DQT, Row #0:   2   1   1   2   3   5   6   7
-    DQT, Row #1:   1   1   2   2   3   7   7   7
-    DQT, Row #2:   2   2   2   3   5   7   8   7
-    DQT, Row #3:   2   2   3   3   6  10  10   7
-    DQT, Row #4:   2   3   4   7   8  13  12   9
-    DQT, Row #5:   3   4   7   8  10  12  14  11
-    DQT, Row #6:   6   8   9  10  12  15  14  12
-    DQT, Row #7:   9  11  11  12  13  12  12  12
-*/
-    constexpr static std::array<std::array<uint8_t, 8>, 8> y_quantization_matrix = {
-        std::array<uint8_t, 8>{2, 1, 1, 2, 3, 5, 6, 7},
-        {1, 1, 2, 2, 3, 7, 7, 7},
-        {2, 2, 2, 3, 5, 7, 8, 7},
-        {2, 2, 3, 3, 6, 10, 10, 7},
-        {2, 3, 4, 7, 8, 13, 12, 9},
-        {3, 4, 7, 8, 10, 12, 14, 11},
-        {6, 8, 9, 10, 12, 15, 14, 12},
-        {9, 11, 11, 12, 13, 12, 12, 12}};
-
-    // constexpr static std::array<std::array<uint8_t, 8>, 8> uv_quantization_matrix = {
-    //     std::array<uint8_t, 8>{17, 18, 24, 47, 99, 99, 99, 99},
-    //     {18, 21, 26, 66, 99, 99, 99, 99},
-    //     {24, 26, 56, 99, 99, 99, 99, 99},
-    //     {47, 66, 99, 99, 99, 99, 99, 99},
-    //     {99, 99, 99, 99, 99, 99, 99, 99},
-    //     {99, 99, 99, 99, 99, 99, 99, 99},
-    //     {99, 99, 99, 99, 99, 99, 99, 99},
-    //     {99, 99, 99, 99, 99, 99, 99, 99}};
-
-    /*  Precision=8 bits
-  Destination ID=1 (Chrominance)
-    DQT, Row #0:   2   2   3   6  12  12  12  12
-    DQT, Row #1:   2   3   3   8  12  12  12  12
-    DQT, Row #2:   3   3   7  12  12  12  12  12
-    DQT, Row #3:   6   8  12  12  12  12  12  12
-    DQT, Row #4:  12  12  12  12  12  12  12  12
-    DQT, Row #5:  12  12  12  12  12  12  12  12
-    DQT, Row #6:  12  12  12  12  12  12  12  12
-    DQT, Row #7:  12  12  12  12  12  12  12  12
-    Approx quality factor = 93.93 (scaling=12.14 variance*/
-
-    constexpr static std::array<std::array<uint8_t, 8>, 8> uv_quantization_matrix = {
-        std::array<uint8_t, 8>{2, 2, 3, 6, 12, 12, 12, 12},
-        {2, 3, 3, 8, 12, 12, 12, 12},
-        {3, 3, 7, 12, 12, 12, 12, 12},
-        {6, 8, 12, 12, 12, 12, 12, 12},
-        {12, 12, 12, 12, 12, 12, 12, 12},
-        {12, 12, 12, 12, 12, 12, 12, 12},
-        {12, 12, 12, 12, 12, 12, 12, 12},
-        {12, 12, 12, 12, 12, 12, 12, 12}};
+        if (end_of_block) {
+            rle[count++] = {0x00, 0};  // EOB
+        }
+        return count;
+    }
 };
 }  // namespace f9ay
 
@@ -0,0 +1,318 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace f9ay {
+
+// T.81 Table D.2 的機率估計狀態機, 每個 entry: Qe << 16 | Next_Index_MPS << 8 | Switch_MPS << 7 | Next_Index_LPS
+// 最後一個 (113) 是固定 0.5 機率的 bin, 只給 AC 的正負號用, 不會跑到別的狀態
+namespace jpeg_arithmetic {
+constexpr uint32_t entry(uint32_t qe, uint32_t next_lps, uint32_t next_mps, uint32_t switch_mps) {
+    return qe << 16 | next_mps << 8 | switch_mps << 7 | next_lps;
+}
+
+/* clang-format off */
+inline constexpr std::array<uint32_t, 114> qe_table = {
+    entry(0x5A1D,   1,   1, 1), entry(0x2586,  14,   2, 0), entry(0x1114,  16,   3, 0), entry(0x080B,  18,   4, 0),
+    entry(0x03D8,  20,   5, 0), entry(0x01DA,  23,   6, 0), entry(0x00E5,  25,   7, 0), entry(0x006F,  28,   8, 0),
+    entry(0x0036,  30,   9, 0), entry(0x001A,  33,  10, 0), entry(0x000D,  35,  11, 0), entry(0x0006,   9,  12, 0),
+    entry(0x0003,  10,  13, 0), entry(0x0001,  12,  13, 0), entry(0x5A7F,  15,  15, 1), entry(0x3F25,  36,  16, 0),
+    entry(0x2CF2,  38,  17, 0), entry(0x207C,  39,  18, 0), entry(0x17B9,  40,  19, 0), entry(0x1182,  42,  20, 0),
+    entry(0x0CEF,  43,  21, 0), entry(0x09A1,  45,  22, 0), entry(0x072F,  46,  23, 0), entry(0x055C,  48,  24, 0),
+    entry(0x0406,  49,  25, 0), entry(0x0303,  51,  26, 0), entry(0x0240,  52,  27, 0), entry(0x01B1,  54,  28, 0),
+    entry(0x0144,  56,  29, 0), entry(0x00F5,  57,  30, 0), entry(0x00B7,  59,  31, 0), entry(0x008A,  60,  32, 0),
+    entry(0x0068,  62,  33, 0), entry(0x004E,  63,  34, 0), entry(0x003B,  32,  35, 0), entry(0x002C,  33,   9, 0),
+    entry(0x5AE1,  37,  37, 1), entry(0x484C,  64,  38, 0), entry(0x3A0D,  65,  39, 0), entry(0x2EF1,  67,  40, 0),
+    entry(0x261F,  68,  41, 0), entry(0x1F33,  69,  42, 0), entry(0x19A8,  70,  43, 0), entry(0x1518,  72,  44, 0),
+    entry(0x1177,  73,  45, 0), entry(0x0E74,  74,  46, 0), entry(0x0BFB,  75,  47, 0), entry(0x09F8,  77,  48, 0),
+    entry(0x0861,  78,  49, 0), entry(0x0706,  79,  50, 0), entry(0x05CD,  48,  51, 0), entry(0x04DE,  50,  52, 0),
+    entry(0x040F,  50,  53, 0), entry(0x0363,  51,  54, 0), entry(0x02D4,  52,  55, 0), entry(0x025C,  53,  56, 0),
+    entry(0x01F8,  54,  57, 0), entry(0x01A4,  55,  58, 0), entry(0x0160,  56,  59, 0), entry(0x0125,  57,  60, 0),
+    entry(0x00F6,  58,  61, 0), entry(0x00CB,  59,  62, 0), entry(0x00AB,  61,  63, 0), entry(0x008F,  61,  32, 0),
+    entry(0x5B12,  65,  65, 1), entry(0x4D04,  80,  66, 0), entry(0x412C,  81,  67, 0), entry(0x37D8,  82,  68, 0),
+    entry(0x2FE8,  83,  69, 0), entry(0x293C,  84,  70, 0), entry(0x2379,  86,  71, 0), entry(0x1EDF,  87,  72, 0),
+    entry(0x1AA9,  87,  73, 0), entry(0x174E,  72,  74, 0), entry(0x1424,  72,  75, 0), entry(0x119C,  74,  76, 0),
+    entry(0x0F6B,  74,  77, 0), entry(0x0D51,  75,  78, 0), entry(0x0BB6,  77,  79, 0), entry(0x0A40,  77,  48, 0),
+    entry(0x5832,  80,  81, 1), entry(0x4D1C,  88,  82, 0), entry(0x438E,  89,  83, 0), entry(0x3BDD,  90,  84, 0),
+    entry(0x34EE,  91,  85, 0), entry(0x2EAE,  92,  86, 0), entry(0x299A,  93,  87, 0), entry(0x2516,  86,  71, 0),
+    entry(0x5570,  88,  89, 1), entry(0x4CA9,  95,  90, 0), entry(0x44D9,  96,  91, 0), entry(0x3E22,  97,  92, 0),
+    entry(0x3824,  99,  93, 0), entry(0x32B4,  99,  94, 0), entry(0x2E17,  93,  86, 0), entry(0x56A8,  95,  96, 1),
+    entry(0x4F46, 101,  97, 0), entry(0x47E5, 102,  98, 0), entry(0x41CF, 103,  99, 0), entry(0x3C3D, 104, 100, 0),
+    entry(0x375E,  99,  93, 0), entry(0x5231, 105, 102, 0), entry(0x4C0F, 106, 103, 0), entry(0x4639, 107, 104, 0),
+    entry(0x415E, 103,  99, 0), entry(0x5627, 105, 106, 1), entry(0x50E7, 108, 107, 0), entry(0x4B85, 109, 103, 0),
+    entry(0x5597, 110, 109, 0), entry(0x504F, 111, 107, 0), entry(0x5A10, 110, 111, 1), entry(0x5522, 112, 109, 0),
+    entry(0x59EB, 112, 111, 1), entry(0x5A1D, 113, 113, 0),
+};
+/* clang-format on */
+
+constexpr uint8_t fixed_state = 113;
+}  // namespace jpeg_arithmetic
+
+// DAC 的 conditioning: DC 差的大小用 L, U 分成 0 / 小 / 大三類, AC 在 zigzag index <= K 跟之後用不同的 bin
+// 預設值就是 T.81 沒有 DAC 時的值
+struct Jpeg_arithmetic_conditioning {
+    int dc_l = 0;
+    int dc_u = 1;
+    int ac_k = 5;
+};
+
+// 每個 DC / AC 表的適應性統計, 每個 bin 一個 byte: 最高 bit 是 MPS, 低 7 bit 是 qe_table 的 index
+// 只用到 DC 的 49 個跟 AC 的 245 個, 補到 64 / 256
+// 每個 entropy-coded segment (scan 或 restart interval) 開頭都要清成 0
+struct Jpeg_arithmetic_statistics {
+    std::array<std::array<uint8_t, 64>, 4> dc{};
+    std::array<std::array<uint8_t, 256>, 4> ac{};
+    uint8_t fixed = jpeg_arithmetic::fixed_state;
+};
+
+// T.81 Annex D 的 QM 算術編碼器 (Annex F 的 sequential DCT 模型), 輸出直接寫進 buffer, 0xFF 後面補 0x00
+// DC 的 context 跟著 component, 統計跟著表 (一般是 Y 用 0, Cb Cr 共用 1)
+class Jpeg_arithmetic_encoder {
+public:
+    explicit Jpeg_arithmetic_encoder(std::vector<std::byte> &out, const Jpeg_arithmetic_conditioning &conditioning = {})
+        : out(out), conditioning(conditioning) {}
+
+    // block 是量化後的 zigzag 係數, block[0] 不使用, DC 的部分用 dc_diff (跟前一個 block 的差)
+    void encode_block(int component, int table, int dc_diff, std::span<const int, 64> block) {
+        encode_dc(component, table, dc_diff);
+        encode_ac(table, block);
+    }
+
+    // 結束這個 entropy-coded segment (T.81 D.1.8), 暫存器跟統計都重新開始, 之後可以接 RSTn 繼續編碼
+    void finish() {
+        // 在 [c, c + a) 裡找結尾 0 最多的值, 最後的 0 byte 可以不寫
+        const uint32_t temp = (a - 1 + c) & 0xFFFF0000u;
+        c = temp < c ? temp + 0x8000u : temp;
+        c <<= ct;
+        if (c & 0xF8000000u) {
+            carry();
+        } else {
+            settle();
+        }
+        if (c & 0x7FFF800u) {
+            emit_zeros();
+            emit_byte(static_cast<uint8_t>(c >> 19));
+            if (c & 0x7F800u) {
+                emit_byte(static_cast<uint8_t>(c >> 11));
+            }
+        }
+        reset();
+    }
+
+private:
+    std::vector<std::byte> &out;
+    Jpeg_arithmetic_conditioning conditioning;
+    Jpeg_arithmetic_statistics statistics;
+    std::array<int, 3> dc_context{};
+    // T.81 D.1 的 C, A, CT 暫存器
+    uint32_t c = 0;
+    uint32_t a = 0x10000u;
+    int ct = 11;
+    // 還沒確定的輸出: pending 是最後一個可能因為進位 +1 的 byte (-1 代表沒有),
+    // 它後面接著 stacked_ff 個 0xFF, 進位時全部變成 0x00; zeros 是 pending 之前還沒寫出的 0x00 個數
+    int pending = -1;
+    int stacked_ff = 0;
+    int zeros = 0;
+
+    void reset() {
+        statistics = {};
+        dc_context = {};
+        c = 0;
+        a = 0x10000u;
+        ct = 11;
+        pending = -1;
+        stacked_ff = 0;
+        zeros = 0;
+    }
+
+    // T.81 F.1.4.1 跟 Figure F.4 ~ F.9
+    void encode_dc(int component, int table, int diff) {
+        auto &bins = statistics.dc[table];
+        int st = dc_context[component];
+        if (diff == 0) {
+            encode(bins[st], 0);
+            dc_context[component] = 0;
+            return;
+        }
+        encode(bins[st], 1);
+        int v = diff;
+        if (v > 0) {
+            encode(bins[st + 1], 0);
+            st += 2;
+            dc_context[component] = 4;
+        } else {
+            v = -v;
+            encode(bins[st + 1], 1);
+            st += 3;
+            dc_context[component] = 8;
+        }
+        // magnitude category
+        int m = 0;
+        if (--v) {
+            encode(bins[st], 1);
+            m = 1;
+            st = 20;
+            for (int v2 = v >> 1; v2; v2 >>= 1) {
+                encode(bins[st], 1);
+                m <<= 1;
+                st++;
+            }
+        }
+        encode(bins[st], 0);
+        if (m < (1 << conditioning.dc_l) >> 1) {
+            dc_context[component] = 0;
+        } else if (m > (1 << conditioning.dc_u) >> 1) {
+            dc_context[component] += 8;
+        }
+        // magnitude bit pattern
+        st += 14;
+        while (m >>= 1) {
+            encode(bins[st], (m & v) ? 1 : 0);
+        }
+    }
+
+    // T.81 F.1.4.2 跟 Figure F.5 ~ F.9
+    void encode_ac(int table, std::span<const int, 64> block) {
+        auto &bins = statistics.ac[table];
+        int end = 63;
+        while (end > 0 && block[end] == 0) {
+            end--;
+        }
+        int k = 1;
+        for (; k <= end; k++) {
+            int st = 3 * (k - 1);
+            encode(bins[st], 0);  // 不是 EOB
+            while (block[k] == 0) {
+                encode(bins[st + 1], 0);
+                st += 3;
+                k++;
+            }
+            encode(bins[st + 1], 1);
+            int v = block[k];
+            if (v > 0) {
+                encode(statistics.fixed, 0);
+            } else {
+                v = -v;
+                encode(statistics.fixed, 1);
+            }
+            st += 2;
+            // magnitude category
+            int m = 0;
+            if (--v) {
+                encode(bins[st], 1);
+                m = 1;
+                if (int v2 = v >> 1) {
+                    encode(bins[st], 1);
+                    m <<= 1;
+                    st = k <= conditioning.ac_k ? 189 : 217;
+                    while (v2 >>= 1) {
+                        encode(bins[st], 1);
+                        m <<= 1;
+                        st++;
+                    }
+                }
+            }
+            encode(bins[st], 0);
+            // magnitude bit pattern
+            st += 14;
+            while (m >>= 1) {
+                encode(bins[st], (m & v) ? 1 : 0);
+            }
+        }
+        if (k <= 63) {
+            encode(bins[3 * (k - 1)], 1);  // EOB
+        }
+    }
+
+    // T.81 D.1.4 ~ D.1.6: 編碼一個 binary decision, 順便更新 state 的機率估計
+    void encode(uint8_t &state, int bit) {
+        const uint32_t entry = jpeg_arithmetic::qe_table[state & 0x7F];
+        const uint32_t qe = entry >> 16;
+        const auto next_lps = static_cast<uint8_t>(entry & 0xFF);  // 包含 Switch_MPS
+        const auto next_mps = static_cast<uint8_t>(entry >> 8 & 0xFF);
+
+        a -= qe;
+        if (bit != state >> 7) {
+            // LPS, 比 MPS 的區間大時交換
+            if (a >= qe) {
+                c += a;
+                a = qe;
+            }
+            state = (state & 0x80) ^ next_lps;
+        } else {
+            if (a >= 0x8000u) {
+                return;
+            }
+            if (a < qe) {
+                c += a;
+                a = qe;
+            }
+            state = (state & 0x80) ^ next_mps;
+        }
+
+        // renormalization, 每 8 個 bit 確定一個 byte
+        do {
+            a <<= 1;
+            c <<= 1;
+            if (--ct == 0) {
+                const uint32_t temp = c >> 19;
+                if (temp > 0xFF) {
+                    carry();
+                    pending = static_cast<int>(temp & 0xFF);
+                } else if (temp == 0xFF) {
+                    stacked_ff++;
+                } else {
+                    settle();
+                    pending = static_cast<int>(temp);
+                }
+                c &= 0x7FFFFu;
+                ct += 8;
+            }
+        } while (a < 0x8000u);
+    }
+
+    // 進位: pending + 1 寫出, 後面堆著的 0xFF 都變成 0x00
+    void carry() {
+        if (pending >= 0) {
+            emit_zeros();
+            emit_byte(static_cast<uint8_t>(pending + 1));
+        }
+        zeros += stacked_ff;
+        stacked_ff = 0;
+    }
+
+    // 不會再進位了: 寫出 pending 跟堆著的 0xFF, 0x00 先留著 (最後的 0x00 可以不寫)
+    void settle() {
+        if (pending == 0) {
+            zeros++;
+        } else if (pending > 0) {
+            emit_zeros();
+            emit_byte(static_cast<uint8_t>(pending));
+        }
+        if (stacked_ff > 0) {
+            emit_zeros();
+            for (; stacked_ff > 0; stacked_ff--) {
+                emit_byte(0xFF);
+            }
+        }
+    }
+
+    void emit_zeros() {
+        for (; zeros > 0; zeros--) {
+            out.push_back(std::byte{0});
+        }
+    }
+
+    void emit_byte(uint8_t byte) {
+        out.push_back(std::byte{byte});
+        if (byte == 0xFF) {
+            out.push_back(std::byte{0});
+        }
+    }
+};
+
+}  // namespace f9ay
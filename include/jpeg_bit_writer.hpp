@@ -0,0 +1,74 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "huffman_coeff.hpp"
+
+namespace f9ay {
+
+// JPEG 熵編碼用的 MSB first bit writer
+// bit 先累積在 64 bit 的暫存器裡, 每滿 32 bit 一次寫出 4 byte, 寫出時直接插入 0xFF 後面的 0x00
+// 所以輸出的 buffer 就是 stuffing 過的 entropy coded segment, 不需要再掃一次
+class Jpeg_bit_writer {
+public:
+    explicit Jpeg_bit_writer(std::vector<std::byte> &out) : out(out) {}
+
+    // 寫入 value 的低 count 個 bit, count <= 32
+    void write(uint32_t value, int count) {
+        accumulator = (accumulator << count) | value;
+        bit_count += count;
+        if (bit_count >= 32) {
+            bit_count -= 32;
+            emit_word(static_cast<uint32_t>(accumulator >> bit_count));
+        }
+    }
+
+    // huffman code 跟後面的 amplitude 一起寫, code 最長 16 bit, amplitude 最長 16 bit
+    void write_symbol(huffman_coeff code, uint32_t amplitude, int amplitude_bits) {
+        write((static_cast<uint32_t>(code.value) << amplitude_bits) | amplitude, code.length + amplitude_bits);
+    }
+
+    // 剩下不滿一個 byte 的部分用 1 補滿後寫出 (T.81 F.1.2.3)
+    void flush() {
+        const int pad = (8 - bit_count % 8) % 8;
+        accumulator = (accumulator << pad) | ((1u << pad) - 1);
+        bit_count += pad;
+        while (bit_count > 0) {
+            bit_count -= 8;
+            emit_byte(static_cast<uint8_t>(accumulator >> bit_count));
+        }
+    }
+
+private:
+    std::vector<std::byte> &out;
+    uint64_t accumulator = 0;
+    int bit_count = 0;
+
+    void emit_byte(uint8_t byte) {
+        out.push_back(std::byte{byte});
+        if (byte == 0xFF) {
+            out.push_back(std::byte{0});
+        }
+    }
+
+    void emit_word(uint32_t word) {
+        // SWAR: ~word 有 0 byte 代表 word 有 0xFF byte
+        const uint32_t inverted = ~word;
+        if (((inverted - 0x01010101u) & ~inverted & 0x80808080u) == 0) [[likely]] {
+            const uint32_t big_endian = std::endian::native == std::endian::little ? std::byteswap(word) : word;
+            const auto size = out.size();
+            out.resize(size + 4);
+            std::memcpy(out.data() + size, &big_endian, 4);
+            return;
+        }
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            emit_byte(static_cast<uint8_t>(word >> shift));
+        }
+    }
+};
+
+}  // namespace f9ay
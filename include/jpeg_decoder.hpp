@@ -0,0 +1,841 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "color_convert.hpp"
+#include "colors.hpp"
+#include "dct.hpp"
+#include "jpeg_arithmetic.hpp"
+#include "jpeg_huffman.hpp"
+#include "jpeg_quantize.hpp"
+#include "matrix.hpp"
+
+namespace f9ay {
+
+// 熵編碼資料的 MSB first bit reader, 讀的時候順便拿掉 0xFF 後面補的 0x00
+// bit 靠左放在 64 bit 的暫存器裡, 每次補到 56 bit 以上, 碰到 marker 就停在 marker 前面, 之後都補 0
+// end 是 nullptr 時不檢查長度, 一直讀到 marker 為止
+class Jpeg_bit_reader {
+public:
+    Jpeg_bit_reader(const std::byte *begin, const std::byte *end) : cur(begin), end(end) {}
+
+    // 偷看接下來的 count 個 bit, count <= 32
+    uint32_t peek(int count) {
+        if (bit_count < count) {
+            fill();
+        }
+        return static_cast<uint32_t>(buffer >> (64 - count));
+    }
+
+    void skip(int count) {
+        buffer <<= count;
+        bit_count -= count;
+    }
+
+    // 讀 size 個 bit 並還原成有號數 (T.81 F.2.2.1 EXTEND)
+    int receive_extend(int size) {
+        if (size == 0) {
+            return 0;
+        }
+        const int value = static_cast<int>(peek(size));
+        skip(size);
+        return value < (1 << (size - 1)) ? value - (1 << size) + 1 : value;
+    }
+
+    // 丟掉剩下的 bit, 跳過 RSTn
+    void restart() {
+        const auto *marker = next_marker();
+        if (!readable(marker, 2) || (static_cast<uint8_t>(marker[1]) & 0xF8) != 0xD0) {
+            throw std::runtime_error("Corrupt JPEG data: missing restart marker");
+        }
+        cur = marker + 2;
+        buffer = 0;
+        bit_count = 0;
+        at_marker = false;
+    }
+
+    // 從目前位置往後找下一個 marker (0xFF 且後面不是 0x00), 回傳指向 0xFF 的位置
+    const std::byte *next_marker() const {
+        const auto *p = cur;
+        while (readable(p, 2)) {
+            if (static_cast<uint8_t>(p[0]) == 0xFF) {
+                const auto next = static_cast<uint8_t>(p[1]);
+                if (next == 0x00) {
+                    p += 2;
+                    continue;
+                }
+                if (next != 0xFF) {
+                    return p;
+                }
+            }
+            p++;
+        }
+        throw std::runtime_error("Corrupt JPEG data: missing marker after scan");
+    }
+
+private:
+    const std::byte *cur;
+    const std::byte *end;
+    uint64_t buffer = 0;
+    int bit_count = 0;
+    bool at_marker = false;
+
+    bool readable(const std::byte *p, std::ptrdiff_t count) const {
+        return end == nullptr || end - p >= count;
+    }
+
+    void fill() {
+        while (bit_count <= 56) {
+            uint8_t byte = 0;
+            if (!at_marker && readable(cur, 1)) {
+                byte = static_cast<uint8_t>(*cur);
+                if (byte != 0xFF) {
+                    cur++;
+                } else if (readable(cur, 2) && static_cast<uint8_t>(cur[1]) == 0x00) {
+                    cur += 2;
+                } else {
+                    at_marker = true;
+                    byte = 0;
+                }
+            }
+            buffer |= static_cast<uint64_t>(byte) << (56 - bit_count);
+            bit_count += 8;
+        }
+    }
+};
+
+// 解碼用的 huffman 表: 長度 <= lookup_bits 的 code 查一次表就好,
+// 比較長的 code 照 T.81 F.2.2.3 的 maxcode / valptr 逐個長度比對
+class Jpeg_huffman_decoder {
+public:
+    static constexpr int lookup_bits = 9;
+
+    explicit Jpeg_huffman_decoder(const Jpeg_huffman_table &table) : values(table.values) {
+        int code = 0;
+        int index = 0;
+        for (int length = 1; length <= 16; length++) {
+            const int count = table.bits[length - 1];
+            value_offset[length] = index - code;
+            for (int i = 0; i < count; i++, code++, index++) {
+                if (code >= (1 << length)) {
+                    throw std::runtime_error("Corrupt JPEG data: bad huffman table");
+                }
+                if (length <= lookup_bits) {
+                    const int shift = lookup_bits - length;
+                    std::fill_n(&lookup[code << shift], 1 << shift,
+                                Entry{static_cast<uint8_t>(length), table.values[index]});
+                }
+            }
+            max_code[length] = count > 0 ? code - 1 : -1;
+            code <<= 1;
+        }
+    }
+
+    uint8_t decode(Jpeg_bit_reader &reader) const {
+        const auto entry = lookup[reader.peek(lookup_bits)];
+        if (entry.length != 0) [[likely]] {
+            reader.skip(entry.length);
+            return entry.symbol;
+        }
+        const auto bits = static_cast<int>(reader.peek(16));
+        for (int length = lookup_bits + 1; length <= 16; length++) {
+            const int code = bits >> (16 - length);
+            if (code <= max_code[length]) {
+                reader.skip(length);
+                return values[value_offset[length] + code];
+            }
+        }
+        throw std::runtime_error("Corrupt JPEG data: bad huffman code");
+    }
+
+private:
+    struct Entry {
+        uint8_t length = 0;  // 0 代表 code 比 lookup_bits 長
+        uint8_t symbol = 0;
+    };
+
+    std::array<Entry, 1 << lookup_bits> lookup{};
+    std::array<int, 17> max_code{};
+    std::array<int, 17> value_offset{};
+    std::array<uint8_t, 256> values{};
+};
+
+// T.81 D.2 的 QM 算術解碼器, 從 Jpeg_bit_reader 一次拿一個 byte (0xFF 0x00 已經還原, 碰到 marker 之後都是 0)
+class Jpeg_arithmetic_decoder {
+public:
+    Jpeg_arithmetic_statistics statistics;
+
+    // 新的 entropy-coded segment 開頭, 統計跟暫存器都重新開始
+    void reset() {
+        statistics = {};
+        c = 0;
+        a = 0;
+        ct = -16;  // 先讀 2 個 byte 填滿 C
+    }
+
+    // 解一個 binary decision, 順便更新 state 的機率估計 (D.2.4 ~ D.2.6)
+    int decode(Jpeg_bit_reader &reader, uint8_t &state) {
+        while (a < 0x8000) {
+            if (--ct < 0) {
+                c = c << 8 | reader.peek(8);
+                reader.skip(8);
+                if ((ct += 8) < 0 && ++ct == 0) {
+                    a = 0x8000;  // 讀完開頭的 2 個 byte, 迴圈結束時 a = 0x10000
+                }
+            }
+            a <<= 1;
+        }
+
+        const uint32_t entry = jpeg_arithmetic::qe_table[state & 0x7F];
+        const int64_t qe = entry >> 16;
+        const auto next_lps = static_cast<uint8_t>(entry & 0xFF);  // 包含 Switch_MPS
+        const auto next_mps = static_cast<uint8_t>(entry >> 8 & 0xFF);
+        int bit = state >> 7;
+
+        a -= qe;
+        const int64_t temp = a << ct;
+        if (c >= temp) {
+            c -= temp;
+            // LPS 的區間, 比 MPS 的區間小時才真的是 LPS
+            if (a < qe) {
+                state = (state & 0x80) ^ next_mps;
+            } else {
+                state = (state & 0x80) ^ next_lps;
+                bit ^= 1;
+            }
+            a = qe;
+        } else if (a < 0x8000) {
+            if (a < qe) {
+                state = (state & 0x80) ^ next_lps;
+                bit ^= 1;
+            } else {
+                state = (state & 0x80) ^ next_mps;
+            }
+        }
+        return bit;
+    }
+
+private:
+    // T.81 D.2 的 C, A, CT 暫存器, 跟 libjpeg 一樣用比 32 bit 寬的型別, 不用擔心 C 左移溢位
+    int64_t c = 0;
+    int64_t a = 0;
+    int ct = -16;
+};
+
+struct Jpeg_decode_options {
+    // 1, 2, 4, 8: 直接在 DCT 域解出 1/scale 大小的圖, 做縮圖時不用先解出原圖
+    // 每個 block 只用左上 (8 / scale) x (8 / scale) 的低頻係數做比較小的 IDCT, scale = 8 只用 DC
+    int scale = 1;
+};
+
+// 熵解碼後還沒反量化的係數, 給不經過 IDCT 的無損轉換用
+struct Jpeg_coefficients {
+    using block_t = std::array<int16_t, 64>;  // zigzag 順序
+
+    struct Component {
+        int id = 0;
+        int h = 1, v = 1;
+        int quant_table = 0;
+        // 補齊到 MCU 的大小, row-major
+        int blocks_width = 0, blocks_height = 0;
+        std::vector<block_t> blocks;
+
+        block_t &at(int block_row, int block_col) {
+            return blocks[static_cast<std::size_t>(block_row) * blocks_width + block_col];
+        }
+
+        const block_t &at(int block_row, int block_col) const {
+            return blocks[static_cast<std::size_t>(block_row) * blocks_width + block_col];
+        }
+    };
+
+    int height = 0, width = 0;
+    std::vector<Component> components;
+    std::array<std::array<uint16_t, 64>, 4> quant_tables{};  // zigzag 順序
+    std::array<bool, 4> quant_defined{};
+};
+
+// sequential (SOF0 / SOF1, 算術編碼的 SOF9) 的 JPEG 解碼
+// 支援 1 (灰階) 或 3 個 component, sampling factor 1 或 2, restart interval, 一個 component 一個 scan 的檔案
+// 每個 block 解碼完馬上做 IDCT 寫進 component 的 sample plane,
+// 輸出時以 MCU row 為單位, chroma 升頻跟 YCbCr -> BGR 在同一個迴圈裡做
+class Jpeg_decoder {
+public:
+    // size 是 0 時不檢查長度, 讀到 EOI 為止
+    static Matrix<colors::BGR> decode(const std::byte *source, std::size_t size = 0,
+                                      const Jpeg_decode_options &options = {}) {
+        if (options.scale != 1 && options.scale != 2 && options.scale != 4 && options.scale != 8) {
+            throw std::invalid_argument("JPEG decode scale must be 1, 2, 4 or 8");
+        }
+        Jpeg_decoder decoder(source, size == 0 ? nullptr : source + size, 8 / options.scale);
+        decoder.run();
+        if (!decoder.image_done) {
+            for (int mcu_row = 0; mcu_row < decoder.mcus_y; mcu_row++) {
+                decoder.output_mcu_row(mcu_row);
+            }
+        }
+        return std::move(decoder.image);
+    }
+
+    // 只做熵解碼, 保留量化後的係數
+    static Jpeg_coefficients read_coefficients(const std::byte *source, std::size_t size = 0) {
+        Jpeg_decoder decoder(source, size == 0 ? nullptr : source + size, 0);
+        decoder.run();
+        Jpeg_coefficients result;
+        result.height = decoder.height;
+        result.width = decoder.width;
+        result.quant_tables = decoder.quant_tables;
+        result.quant_defined = decoder.quant_defined;
+        for (auto &component : decoder.components) {
+            result.components.push_back({component.id, component.h, component.v, component.quant_table,
+                                         component.blocks_width, component.blocks_height,
+                                         std::move(component.coefficients)});
+        }
+        return result;
+    }
+
+private:
+    struct Component {
+        int id = 0;
+        int h = 1, v = 1;
+        int quant_table = 0;
+        int dc_table = 0, ac_table = 0;
+        int dc_pred = 0;
+        int dc_context = 0;  // 算術編碼的 DC context (T.81 F.1.4.4.1.2)
+        // 補齊到 MCU 的大小, 每個 block 在 samples 裡佔 block_size x block_size
+        int blocks_width = 0, blocks_height = 0;
+        int stride = 0;
+        std::vector<uint8_t> samples;
+        // read_coefficients 時不做 IDCT, 改存量化後的 zigzag 係數
+        std::vector<Jpeg_coefficients::block_t> coefficients;
+    };
+
+    const std::byte *cur;
+    const std::byte *end;
+    // 每個 block 解出來的邊長, 8 / scale, 0 代表只保留係數
+    int block_size;
+
+    int height = 0, width = 0;
+    int output_height = 0, output_width = 0;
+    int h_max = 1, v_max = 1;
+    int mcus_x = 0, mcus_y = 0;
+    std::vector<Component> components;
+    std::array<std::array<uint16_t, 64>, 4> quant_tables{};  // zigzag 順序
+    std::array<bool, 4> quant_defined{};
+    std::array<std::optional<Jpeg_huffman_decoder>, 4> dc_tables, ac_tables;
+    bool arithmetic = false;
+    std::array<Jpeg_arithmetic_conditioning, 4> conditioning{};  // 依表的 id, DAC 沒寫的就是預設值
+    Jpeg_arithmetic_decoder arithmetic_decoder;
+    int restart_interval = 0;
+
+    Matrix<colors::BGR> image;
+    bool image_done = false;
+
+    Jpeg_decoder(const std::byte *source, const std::byte *end, int block_size)
+        : cur(source), end(end), block_size(block_size) {}
+
+    void need(std::ptrdiff_t count) const {
+        if (end != nullptr && end - cur < count) {
+            throw std::runtime_error("Corrupt JPEG data: unexpected end of file");
+        }
+    }
+
+    uint8_t read_u8() {
+        need(1);
+        return static_cast<uint8_t>(*cur++);
+    }
+
+    uint16_t read_u16() {
+        const uint16_t high = read_u8();
+        return static_cast<uint16_t>(high << 8 | read_u8());
+    }
+
+    // 讀 segment 的長度, 回傳 segment 結束的位置
+    const std::byte *read_segment_length() {
+        const int length = read_u16();
+        if (length < 2) {
+            throw std::runtime_error("Corrupt JPEG data: bad segment length");
+        }
+        need(length - 2);
+        return cur + length - 2;
+    }
+
+    void run() {
+        if (read_u8() != 0xFF || read_u8() != 0xD8) {
+            throw std::runtime_error("Not a JPEG file");
+        }
+        bool has_scan = false;
+        for (;;) {
+            if (read_u8() != 0xFF) {
+                throw std::runtime_error("Corrupt JPEG data: expected a marker");
+            }
+            uint8_t marker = read_u8();
+            while (marker == 0xFF) {  // marker 前面可以有任意個 0xFF
+                marker = read_u8();
+            }
+            if (marker == 0xD9) {  // EOI
+                break;
+            }
+            switch (marker) {
+                case 0xC0:
+                case 0xC1:
+                    read_frame();
+                    break;
+                case 0xC9:
+                    arithmetic = true;
+                    read_frame();
+                    break;
+                case 0xC2:
+                case 0xC3:
+                case 0xC5:
+                case 0xC6:
+                case 0xC7:
+                case 0xCA:
+                case 0xCB:
+                case 0xCD:
+                case 0xCE:
+                case 0xCF:
+                    throw std::runtime_error(
+                        "Unsupported JPEG: only sequential DCT (SOF0 / SOF1 / SOF9) is supported");
+                case 0xC4:
+                    read_dht();
+                    break;
+                case 0xCC:
+                    read_dac();
+                    break;
+                case 0xDB:
+                    read_dqt();
+                    break;
+                case 0xDD: {
+                    const auto *segment_end = read_segment_length();
+                    restart_interval = read_u16();
+                    cur = segment_end;
+                    break;
+                }
+                case 0xDA:
+                    read_scan();
+                    has_scan = true;
+                    break;
+                default:  // APPn, COM ...
+                    cur = read_segment_length();
+                    break;
+            }
+        }
+        if (!has_scan) {
+            throw std::runtime_error("Corrupt JPEG data: no image data");
+        }
+    }
+
+    void read_frame() {
+        const auto *segment_end = read_segment_length();
+        if (!components.empty()) {
+            throw std::runtime_error("Corrupt JPEG data: more than one frame");
+        }
+        if (read_u8() != 8) {
+            throw std::runtime_error("Unsupported JPEG: only 8 bit samples are supported");
+        }
+        height = read_u16();
+        width = read_u16();
+        const int count = read_u8();
+        if (height == 0 || width == 0) {
+            throw std::runtime_error("Unsupported JPEG: image size must be given in the frame header");
+        }
+        if (count != 1 && count != 3) {
+            throw std::runtime_error("Unsupported JPEG: only 1 or 3 components are supported");
+        }
+        components.resize(count);
+        for (auto &component : components) {
+            component.id = read_u8();
+            const int factors = read_u8();
+            component.h = factors >> 4;
+            component.v = factors & 0xF;
+            component.quant_table = read_u8();
+            if (component.h < 1 || component.h > 2 || component.v < 1 || component.v > 2) {
+                throw std::runtime_error("Unsupported JPEG: sampling factors must be 1 or 2");
+            }
+            if (component.quant_table > 3) {
+                throw std::runtime_error("Corrupt JPEG data: bad quantization table id");
+            }
+        }
+        cur = segment_end;
+
+        // 只有一個 component 時 MCU 就是一個 block, sampling factor 沒有意義
+        if (count == 1) {
+            components[0].h = components[0].v = 1;
+        }
+        for (const auto &component : components) {
+            h_max = std::max(h_max, component.h);
+            v_max = std::max(v_max, component.v);
+        }
+        if (components[0].h != h_max || components[0].v != v_max ||
+            (count == 3 && components[1].h != components[2].h)) {
+            throw std::runtime_error("Unsupported JPEG: unusual sampling factors");
+        }
+        mcus_x = (width + 8 * h_max - 1) / (8 * h_max);
+        mcus_y = (height + 8 * v_max - 1) / (8 * v_max);
+        for (auto &component : components) {
+            component.blocks_width = mcus_x * component.h;
+            component.blocks_height = mcus_y * component.v;
+            if (block_size == 0) {
+                component.coefficients.resize(static_cast<std::size_t>(component.blocks_width) *
+                                              component.blocks_height);
+                continue;
+            }
+            component.stride = component.blocks_width * block_size;
+            component.samples.resize(static_cast<std::size_t>(component.stride) * component.blocks_height * block_size);
+        }
+        if (block_size == 0) {
+            return;
+        }
+        // 跟 libjpeg 一樣無條件進位
+        const int scale = 8 / block_size;
+        output_height = (height + scale - 1) / scale;
+        output_width = (width + scale - 1) / scale;
+        image = Matrix<colors::BGR>(output_height, output_width);
+    }
+
+    void read_dqt() {
+        const auto *segment_end = read_segment_length();
+        while (cur < segment_end) {
+            const int info = read_u8();
+            const int precision = info >> 4;
+            const int id = info & 0xF;
+            if (id > 3 || precision > 1) {
+                throw std::runtime_error("Corrupt JPEG data: bad quantization table");
+            }
+            for (auto &q : quant_tables[id]) {
+                q = precision == 0 ? read_u8() : read_u16();
+            }
+            quant_defined[id] = true;
+        }
+        cur = segment_end;
+    }
+
+    void read_dht() {
+        const auto *segment_end = read_segment_length();
+        while (cur < segment_end) {
+            const int info = read_u8();
+            const int table_class = info >> 4;
+            const int id = info & 0xF;
+            if (table_class > 1 || id > 3) {
+                throw std::runtime_error("Corrupt JPEG data: bad huffman table");
+            }
+            std::array<uint8_t, 16> bits;
+            int count = 0;
+            for (auto &bit : bits) {
+                bit = read_u8();
+                count += bit;
+            }
+            if (count > 256) {
+                throw std::runtime_error("Corrupt JPEG data: bad huffman table");
+            }
+            std::array<uint8_t, 256> values;
+            for (int i = 0; i < count; i++) {
+                values[i] = read_u8();
+            }
+            const Jpeg_huffman_table table(bits, std::span<const uint8_t>(values.data(), count));
+            (table_class == 0 ? dc_tables : ac_tables)[id].emplace(table);
+        }
+        cur = segment_end;
+    }
+
+    void read_dac() {
+        const auto *segment_end = read_segment_length();
+        while (cur < segment_end) {
+            const int info = read_u8();
+            const int table_class = info >> 4;
+            const int id = info & 0xF;
+            const int value = read_u8();
+            if (table_class > 1 || id > 3) {
+                throw std::runtime_error("Corrupt JPEG data: bad arithmetic conditioning table");
+            }
+            if (table_class == 0) {
+                conditioning[id].dc_l = value & 0xF;
+                conditioning[id].dc_u = value >> 4;
+                if (conditioning[id].dc_l > conditioning[id].dc_u) {
+                    throw std::runtime_error("Corrupt JPEG data: bad arithmetic conditioning table");
+                }
+            } else {
+                conditioning[id].ac_k = value;
+                if (value < 1 || value > 63) {
+                    throw std::runtime_error("Corrupt JPEG data: bad arithmetic conditioning table");
+                }
+            }
+        }
+        cur = segment_end;
+    }
+
+    void read_scan() {
+        const auto *segment_end = read_segment_length();
+        if (components.empty()) {
+            throw std::runtime_error("Corrupt JPEG data: scan before frame header");
+        }
+        const int count = read_u8();
+        if (count < 1 || count > static_cast<int>(components.size())) {
+            throw std::runtime_error("Corrupt JPEG data: bad scan header");
+        }
+        std::vector<Component *> scan;
+        for (int i = 0; i < count; i++) {
+            const int id = read_u8();
+            const int tables = read_u8();
+            auto it = std::ranges::find(components, id, &Component::id);
+            if (it == components.end()) {
+                throw std::runtime_error("Corrupt JPEG data: scan refers to an unknown component");
+            }
+            it->dc_table = tables >> 4;
+            it->ac_table = tables & 0xF;
+            if (it->dc_table > 3 || it->ac_table > 3 || !quant_defined[it->quant_table] ||
+                (!arithmetic && (!dc_tables[it->dc_table] || !ac_tables[it->ac_table]))) {
+                throw std::runtime_error("Corrupt JPEG data: scan uses an undefined table");
+            }
+            scan.push_back(&*it);
+        }
+        // Ss, Se, Ah/Al 在 sequential 固定是 0, 63, 0
+        const int spectral_start = read_u8();
+        const int spectral_end = read_u8();
+        const int approximation = read_u8();
+        if (cur != segment_end || spectral_start != 0 || spectral_end != 63 || approximation != 0) {
+            throw std::runtime_error("Corrupt JPEG data: bad scan header");
+        }
+
+        Jpeg_bit_reader reader(cur, end);
+        auto reset_prediction = [&] {
+            for (auto *component : scan) {
+                component->dc_pred = 0;
+                component->dc_context = 0;
+            }
+            arithmetic_decoder.reset();
+        };
+        reset_prediction();
+        auto restart = [&](int index) {
+            if (restart_interval > 0 && index > 0 && index % restart_interval == 0) {
+                reader.restart();
+                reset_prediction();
+            }
+        };
+
+        if (count == 1) {
+            // 不交錯的 scan 只有 component 本身解析度涵蓋的 block, 每個 block 是一個 MCU
+            auto &component = *scan[0];
+            const int component_width = (width * component.h + h_max - 1) / h_max;
+            const int component_height = (height * component.v + v_max - 1) / v_max;
+            const int blocks_x = (component_width + 7) / 8;
+            const int blocks_y = (component_height + 7) / 8;
+            for (int index = 0; index < blocks_x * blocks_y; index++) {
+                restart(index);
+                decode_block(reader, component, index / blocks_x, index % blocks_x);
+            }
+        } else {
+            for (int mcu_row = 0; mcu_row < mcus_y; mcu_row++) {
+                for (int mcu_col = 0; mcu_col < mcus_x; mcu_col++) {
+                    restart(mcu_row * mcus_x + mcu_col);
+                    for (auto *component : scan) {
+                        for (int i = 0; i < component->v; i++) {
+                            for (int j = 0; j < component->h; j++) {
+                                decode_block(reader, *component, mcu_row * component->v + i,
+                                             mcu_col * component->h + j);
+                            }
+                        }
+                    }
+                }
+                // 所有 component 都在這個 scan 裡, 這個 MCU row 已經完整, 趁資料還在快取裡直接輸出
+                if (count == static_cast<int>(components.size()) && block_size != 0) {
+                    output_mcu_row(mcu_row);
+                }
+            }
+            image_done = count == static_cast<int>(components.size());
+        }
+        cur = reader.next_marker();
+    }
+
+    // 熵解碼一個 block, 每個非 0 的係數呼叫 store(zigzag index, 量化後的值), 回傳是否有 AC
+    template <typename Store>
+    bool decode_coefficients(Jpeg_bit_reader &reader, Component &component, Store &&store) {
+        if (arithmetic) {
+            return decode_arithmetic_coefficients(reader, component, store);
+        }
+        const auto &dc_table = *dc_tables[component.dc_table];
+        const auto &ac_table = *ac_tables[component.ac_table];
+
+        const int dc_size = dc_table.decode(reader);
+        if (dc_size > 16) {
+            throw std::runtime_error("Corrupt JPEG data: bad DC coefficient");
+        }
+        component.dc_pred += reader.receive_extend(dc_size);
+        store(0, component.dc_pred);
+
+        bool has_ac = false;
+        for (int k = 1; k < 64;) {
+            const int symbol = ac_table.decode(reader);
+            const int run = symbol >> 4;
+            const int size = symbol & 0xF;
+            if (size == 0) {
+                if (run != 15) {
+                    break;  // EOB
+                }
+                k += 16;  // ZRL
+                continue;
+            }
+            k += run;
+            if (k > 63) {
+                throw std::runtime_error("Corrupt JPEG data: bad AC coefficient");
+            }
+            store(k, reader.receive_extend(size));
+            has_ac = true;
+            k++;
+        }
+        return has_ac;
+    }
+
+    // 跟 decode_coefficients 一樣, 但是算術編碼 (T.81 F.2.4, Jpeg_arithmetic_encoder 反過來做)
+    template <typename Store>
+    bool decode_arithmetic_coefficients(Jpeg_bit_reader &reader, Component &component, Store &&store) {
+        auto &statistics = arithmetic_decoder.statistics;
+        const auto &dc_conditioning = conditioning[component.dc_table];
+        const int ac_k = conditioning[component.ac_table].ac_k;
+        auto decode = [&](uint8_t &state) {
+            return arithmetic_decoder.decode(reader, state);
+        };
+        auto grow = [](int &m) {
+            if ((m <<= 1) == 0x8000) {
+                throw std::runtime_error("Corrupt JPEG data: bad arithmetic code");
+            }
+        };
+        // 大小的 bit pattern (Figure F.24), m 是 category 的最高 bit, 回傳 |v|
+        auto decode_bits = [&](std::span<uint8_t> bins, int st, int m) {
+            int v = m;
+            while (m >>= 1) {
+                if (decode(bins[st])) {
+                    v |= m;
+                }
+            }
+            return v + 1;
+        };
+
+        // DC (Figure F.19 ~ F.24)
+        auto &dc = statistics.dc[component.dc_table];
+        int st = component.dc_context;
+        if (decode(dc[st]) == 0) {
+            component.dc_context = 0;
+        } else {
+            const int sign = decode(dc[st + 1]);
+            st += 2 + sign;
+            int m = decode(dc[st]);
+            if (m != 0) {
+                for (st = 20; decode(dc[st]); st++) {
+                    grow(m);
+                }
+            }
+            if (m < (1 << dc_conditioning.dc_l) >> 1) {
+                component.dc_context = 0;
+            } else if (m > (1 << dc_conditioning.dc_u) >> 1) {
+                component.dc_context = 12 + sign * 4;
+            } else {
+                component.dc_context = 4 + sign * 4;
+            }
+            const int v = decode_bits(dc, st + 14, m);
+            component.dc_pred += sign ? -v : v;
+        }
+        store(0, component.dc_pred);
+
+        // AC (Figure F.20 ~ F.24)
+        auto &ac = statistics.ac[component.ac_table];
+        bool has_ac = false;
+        for (int k = 1; k < 64; k++) {
+            st = 3 * (k - 1);
+            if (decode(ac[st])) {
+                break;  // EOB
+            }
+            while (decode(ac[st + 1]) == 0) {
+                st += 3;
+                if (++k > 63) {
+                    throw std::runtime_error("Corrupt JPEG data: bad AC coefficient");
+                }
+            }
+            const int sign = decode(statistics.fixed);
+            st += 2;
+            int m = decode(ac[st]);
+            if (m != 0 && decode(ac[st])) {
+                m <<= 1;
+                for (st = k <= ac_k ? 189 : 217; decode(ac[st]); st++) {
+                    grow(m);
+                }
+            }
+            const int v = decode_bits(ac, st + 14, m);
+            store(k, sign ? -v : v);
+            has_ac = true;
+        }
+        return has_ac;
+    }
+
+    // 解一個 block 並反量化, 接著 IDCT 寫到 component 的第 (block_row, block_col) 個 block
+    void decode_block(Jpeg_bit_reader &reader, Component &component, int block_row, int block_col) {
+        if (block_size == 0) {
+            auto &out =
+                component.coefficients[static_cast<std::size_t>(block_row) * component.blocks_width + block_col];
+            decode_coefficients(reader, component, [&out](int k, int value) {
+                out[k] = static_cast<int16_t>(value);
+            });
+            return;
+        }
+
+        const auto &quant = quant_tables[component.quant_table];
+        Idct_int::block_t block{};
+        const bool has_ac = decode_coefficients(reader, component, [&](int k, int value) {
+            block[jpeg_natural_order[k]] = value * quant[k];
+        });
+
+        auto *out = &component.samples[static_cast<std::size_t>(block_row) * block_size * component.stride +
+                                       block_col * block_size];
+        if (!has_ac) {
+            Idct_int::idct_dc(block[0], out, component.stride, block_size);
+            return;
+        }
+        switch (block_size) {
+            case 8:
+                Idct_int::idct(block, out, component.stride);
+                break;
+            case 4:
+                Idct_int::idct_4x4(block, out, component.stride);
+                break;
+            case 2:
+                Idct_int::idct_2x2(block, out, component.stride);
+                break;
+            default:
+                Idct_int::idct_dc(block[0], out, component.stride, 1);
+                break;
+        }
+    }
+
+    // 把一個 MCU row 的 sample 升頻並轉成 BGR 寫進 image
+    void output_mcu_row(int mcu_row) {
+        const int row_begin = mcu_row * block_size * v_max;
+        const int row_end = std::min(row_begin + block_size * v_max, output_height);
+        const auto &luma = components[0];
+        for (int row = row_begin; row < row_end; row++) {
+            const uint8_t *y = &luma.samples[static_cast<std::size_t>(row) * luma.stride];
+            auto *dst = &image[row, 0];
+            if (components.size() == 1) {
+                for (int col = 0; col < output_width; col++) {
+                    dst[col] = {y[col], y[col], y[col]};
+                }
+                continue;
+            }
+            const auto &cb = components[1];
+            const auto &cr = components[2];
+            const int chroma_shift = h_max / cb.h - 1;
+            const uint8_t *cb_row = &cb.samples[static_cast<std::size_t>(row * cb.v / v_max) * cb.stride];
+            const uint8_t *cr_row = &cr.samples[static_cast<std::size_t>(row * cr.v / v_max) * cr.stride];
+            Ycbcr_to_bgr::convert_row(y, cb_row, cr_row, output_width, chroma_shift, dst);
+        }
+    }
+};
+
+}  // namespace f9ay
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "jpeg.hpp"
+
+namespace f9ay {
+
+// 可以重複使用的 baseline JPEG 編碼器
+// stripe、token 串流、huffman 統計跟輸出 buffer 都由 instance 保留, 第一次編碼之後,
+// 同樣大小以內的圖不會再配置記憶體 (optimized huffman 用固定大小的陣列統計跟建表)
+// 沒有共用的可變狀態, 每個執行緒各用一個 instance 就可以同時編碼; 同一個 instance 不能同時被多個執行緒使用
+template <Jpeg_sampling sampling_type = Jpeg_sampling::ds_4_2_0>
+class Jpeg_encoder {
+    using Codec = Jpeg<sampling_type>;
+    using block_t = typename Codec::block_t;
+    using Token_stream = typename Codec::Token_stream;
+
+public:
+    // 回傳的 span 指向 instance 內部的 buffer, 只在下一次 encode 之前有效
+    // options.scans 必須是空的 (不支援 progressive), restart interval 在同一個執行緒上依序編碼, options.threads 不使用
+    template <colors::color_type ColorType>
+    std::span<const std::byte> encode(const Matrix<ColorType> &src, const Jpeg_options &options = {}) {
+        return encode(src.row(), src.col(), Codec::matrix_rows(src), options);
+    }
+
+    // 跟 Jpeg::write_yuv 一樣直接編碼 YUV 平面
+    std::span<const std::byte> encode(const Jpeg_yuv_planes &planes, const Jpeg_options &options = {}) {
+        Codec::validate_yuv_planes(planes);
+        return encode(planes.height, planes.width, planes, options);
+    }
+
+    template <Jpeg_stripe_source FetchRow>
+    std::span<const std::byte> encode(int height, int width, FetchRow &&fetch_row, const Jpeg_options &options = {}) {
+        if (!options.scans.empty()) {
+            throw std::invalid_argument("Jpeg_encoder only supports baseline output");
+        }
+        const int mcu_rows = Codec::mcu_row_count(height);
+        const int mcus_per_row = align<Codec::mcu_width>(width) / Codec::mcu_width;
+        const int rows_per_interval = options.restart_rows > 0 ? std::min(options.restart_rows, mcu_rows) : 0;
+        if (rows_per_interval * mcus_per_row > 0xFFFF) {
+            throw std::invalid_argument("restart interval is larger than 65535 MCUs");
+        }
+        const int restart_interval = rows_per_interval * mcus_per_row;
+
+        output.clear();
+        if (options.entropy == Jpeg_entropy::arithmetic) {
+            // 算術編碼邊編碼邊適應機率, 一趟就好
+            write_headers(height, width, restart_interval, options, tables);
+            Jpeg_arithmetic_encoder encoder(output);
+            Restart_counter restarts(restart_interval);
+            std::array<int, 3> last_dc{};
+            int restart_index = 0;
+            for_each_quantized_block(height, width, 0, mcu_rows, fetch_row, options, [&](int component, block_t &block) {
+                if (restarts.next_block()) {
+                    encoder.finish();
+                    Codec::template write_data<uint16_t, std::endian::big>(output, 0xFFD0u + restart_index++ % 8);
+                    last_dc = {};
+                }
+                Codec::encode_block(encoder, component, block, last_dc);
+            });
+            encoder.finish();
+            Codec::template write_data<uint16_t, std::endian::big>(output, static_cast<uint16_t>(0xFFD9u));
+            return output;
+        }
+        if (options.huffman != Jpeg_huffman::optimized) {
+            // 標準表不需要統計, 取樣的表只統計一部分 MCU row, 表決定好之後量化完直接熵編碼
+            if (options.huffman == Jpeg_huffman::sampled) {
+                statistics = {};
+                const int step = std::max(options.huffman_sample_rows, 1);
+                for (int mcu_row = 0; mcu_row < mcu_rows; mcu_row += step) {
+                    for_each_quantized_block(height, width, mcu_row, mcu_row + 1, fetch_row, options,
+                                             [&](int component, block_t &block) {
+                                                 statistics.add_block(component, block);
+                                             });
+                }
+                statistics.frequencies.cover_all_symbols(Codec::component_count == 3);
+                tables = statistics.build();
+            } else {
+                tables = Jpeg_huffman_tables::standard();
+            }
+            write_headers(height, width, restart_interval, options, tables);
+            Scan_writer writer(output, restart_interval);
+            for_each_quantized_block(height, width, 0, mcu_rows, fetch_row, options,
+                                     [&](int component, block_t &block) {
+                                         writer.write(component, block, tables);
+                                     });
+            writer.finish();
+            return output;
+        }
+
+        // 第一趟: 轉換、量化後直接變成 token 保留下來, 同時統計 symbol 頻率
+        stream.clear();
+        stream.block_begin.reserve(static_cast<std::size_t>(mcu_rows) * mcus_per_row * Codec::blocks_per_mcu);
+        statistics = {};
+        Restart_counter restarts(restart_interval);
+        for_each_quantized_block(height, width, 0, mcu_rows, fetch_row, options, [&](int component, block_t &block) {
+            if (restarts.next_block()) {
+                stream.reset_prediction();
+            }
+            statistics.add_tokens(component, stream.add_block(component, block));
+        });
+        tables = statistics.build();
+
+        // 第二趟: 用統計出來的表依序寫出 token
+        write_headers(height, width, restart_interval, options, tables);
+        Scan_writer writer(output, restart_interval);
+        for (std::size_t k = 0; k < stream.block_count(); k++) {
+            writer.write(Codec::block_component(k % Codec::blocks_per_mcu), stream.block(k), tables);
+        }
+        writer.finish();
+        return output;
+    }
+
+private:
+    typename Codec::Mcu_stripe stripe;
+    std::vector<block_t> stripe_blocks;
+    Token_stream stream;  // 量化後的 block 的 token, MCU 順序
+    typename Codec::Huffman_statistics statistics;
+    Jpeg_huffman_tables tables;
+    std::vector<std::byte> output;
+
+    // 依 MCU 順序數 block, 找出 restart interval 的邊界
+    struct Restart_counter {
+        int restart_interval;
+        int block_index = 0;
+
+        explicit Restart_counter(int restart_interval) : restart_interval(restart_interval) {}
+
+        // 回傳這個 block 是否剛好跨進新的 restart interval (第一個 interval 除外)
+        bool next_block() {
+            const int mcu = block_index / Codec::blocks_per_mcu;
+            const bool restart = restart_interval > 0 && mcu > 0 && block_index % Codec::blocks_per_mcu == 0 &&
+                                 mcu % restart_interval == 0;
+            block_index++;
+            return restart;
+        }
+    };
+
+    // 依 MCU 順序熵編碼, 在 restart interval 之間補齊 byte 並插入 RSTn
+    struct Scan_writer {
+        std::vector<std::byte> &buffer;
+        Jpeg_bit_writer bit_writer;
+        Restart_counter restarts;
+        std::array<int, 3> last_dc{};
+        int restart_index = 0;
+
+        Scan_writer(std::vector<std::byte> &buffer, int restart_interval)
+            : buffer(buffer), bit_writer(buffer), restarts(restart_interval) {}
+
+        // 量化後的 block, DC 差在這裡算
+        void write(int component, const block_t &block, const Jpeg_huffman_tables &tables) {
+            next_block();
+            Codec::encode_block(bit_writer, component, block, last_dc, tables);
+        }
+
+        // Token_stream 裡的 block, DC 差已經算好了
+        void write(int component, std::span<const uint32_t> block_tokens, const Jpeg_huffman_tables &tables) {
+            next_block();
+            Codec::write_tokens(bit_writer, component, block_tokens, tables);
+        }
+
+        void finish() {
+            bit_writer.flush();
+            Codec::template write_data<uint16_t, std::endian::big>(buffer, static_cast<uint16_t>(0xFFD9u));
+        }
+
+    private:
+        void next_block() {
+            if (restarts.next_block()) {
+                bit_writer.flush();
+                Codec::template write_data<uint16_t, std::endian::big>(buffer, 0xFFD0u + restart_index++ % 8);
+                last_dc = {};
+            }
+        }
+    };
+
+    void write_headers(int height, int width, int restart_interval, const Jpeg_options &options,
+                       const Jpeg_huffman_tables &tables) {
+        Codec::write_headers(output, height, width, options, tables);
+        if (restart_interval > 0) {
+            Codec::write_dri_segment(output, restart_interval);
+        }
+        Codec::write_sos_header(output);
+    }
+
+    template <typename FetchRow, typename OnBlock>
+    void for_each_quantized_block(int height, int width, int mcu_row_begin, int mcu_row_end, FetchRow &fetch_row,
+                                  const Jpeg_options &options, OnBlock &&on_block) {
+        Codec::for_each_dct_block(height, width, mcu_row_begin, mcu_row_end, fetch_row, options, stripe, stripe_blocks,
+                                  [&](int component, block_t &block) {
+                                      auto quantized = Codec::quantize_block(block, component, options);
+                                      on_block(component, quantized);
+                                  });
+    }
+};
+
+}  // namespace f9ay
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+
+#include "huffman_coeff.hpp"
+
+namespace f9ay {
+
+// DHT 格式的 huffman 表: bits[i] 是長度 i + 1 的 code 個數, values 依照 code 長度排列
+// code 依照 Annex C 的規則從 bits / values 產生, 查表只要一次 index
+class Jpeg_huffman_table {
+public:
+    std::array<uint8_t, 16> bits{};
+    std::array<uint8_t, 256> values{};
+    int value_count = 0;
+
+    constexpr Jpeg_huffman_table() = default;
+
+    constexpr Jpeg_huffman_table(const std::array<uint8_t, 16> &code_bits, std::span<const uint8_t> code_values)
+        : bits(code_bits), value_count(static_cast<int>(code_values.size())) {
+        for (int i = 0; i < value_count; i++) {
+            values[i] = code_values[i];
+        }
+        build_codes();
+    }
+
+    // 從 symbol 的出現次數直接產生表 (T.81 Annex K.2, 跟 libjpeg 的 jpeg_gen_optimal_table 一樣)
+    // 只用固定大小的陣列, 不會配置記憶體, 最長的 code 限制在 16 bit 且不會產生全是 1 的 code
+    static Jpeg_huffman_table from_frequencies(const std::array<uint32_t, 256> &counts) {
+        Jpeg_huffman_table table;
+        // 第 256 個是保留的假 symbol, 確保沒有全是 1 的 code
+        std::array<uint64_t, 257> freq{};
+        std::array<int, 257> code_size{};
+        std::array<int, 257> others;
+        others.fill(-1);
+        bool any = false;
+        for (int i = 0; i < 256; i++) {
+            freq[i] = counts[i];
+            any |= counts[i] > 0;
+        }
+        if (!any) {
+            return table;  // 沒有用到的表 (例如灰階的 Cb Cr)
+        }
+        freq[256] = 1;
+
+        // 每次合併頻率最小的兩個, 同樣大小時選 index 大的
+        auto smallest = [&freq](int except) {
+            int index = -1;
+            uint64_t value = ~uint64_t{0};
+            for (int i = 0; i <= 256; i++) {
+                if (freq[i] > 0 && freq[i] <= value && i != except) {
+                    value = freq[i];
+                    index = i;
+                }
+            }
+            return index;
+        };
+        while (true) {
+            int c1 = smallest(-1);
+            int c2 = smallest(c1);
+            if (c2 < 0) {
+                break;
+            }
+            freq[c1] += freq[c2];
+            freq[c2] = 0;
+            code_size[c1]++;
+            while (others[c1] >= 0) {
+                c1 = others[c1];
+                code_size[c1]++;
+            }
+            others[c1] = c2;
+            code_size[c2]++;
+            while (others[c2] >= 0) {
+                c2 = others[c2];
+                code_size[c2]++;
+            }
+        }
+
+        // 超過 16 bit 的 code 往上搬 (K.2 的 Adjust_BITS)
+        // 頻率很不平均時 code 可能超過 32 bit, 257 個 symbol 的 code 最長是 256 bit
+        std::array<int, 257> length_count{};
+        int max_length = 0;
+        for (int i = 0; i <= 256; i++) {
+            if (code_size[i] > 0) {
+                length_count[code_size[i]]++;
+                max_length = std::max(max_length, code_size[i]);
+            }
+        }
+        for (int i = max_length; i > 16; i--) {
+            while (length_count[i] > 0) {
+                int j = i - 2;
+                while (length_count[j] == 0) {
+                    j--;
+                }
+                length_count[i] -= 2;
+                length_count[i - 1]++;
+                length_count[j + 1] += 2;
+                length_count[j]--;
+            }
+        }
+        // 拿掉保留的 symbol, 它一定在最長的那一層
+        int longest = 16;
+        while (length_count[longest] == 0) {
+            longest--;
+        }
+        length_count[longest]--;
+
+        for (int len = 1; len <= 16; len++) {
+            table.bits[len - 1] = static_cast<uint8_t>(length_count[len]);
+        }
+        // symbol 依照原本的 code 長度排列, 搬動長度不影響順序
+        for (int len = 1; len <= max_length; len++) {
+            for (int i = 0; i < 256; i++) {
+                if (code_size[i] == len) {
+                    table.values[table.value_count++] = static_cast<uint8_t>(i);
+                }
+            }
+        }
+        table.build_codes();
+        return table;
+    }
+
+    constexpr huffman_coeff getMapping(uint16_t symbol) const {
+        return codes[symbol];
+    }
+
+    constexpr std::span<const uint8_t> symbols() const {
+        return {values.data(), static_cast<std::size_t>(value_count)};
+    }
+
+private:
+    std::array<huffman_coeff, 256> codes{};
+
+    constexpr void build_codes() {
+        uint16_t code = 0;
+        int index = 0;
+        for (int len = 1; len <= 16; len++) {
+            for (int i = 0; i < bits[len - 1]; i++) {
+                codes[values[index++]] = huffman_coeff(code++, len);
+            }
+            code <<= 1;
+        }
+    }
+};
+
+// 四張表各自的 symbol 出現次數, 固定大小, 可以重複使用
+struct Jpeg_huffman_frequencies {
+    std::array<uint32_t, 256> y_dc{}, y_ac{}, uv_dc{}, uv_ac{};
+
+    void clear() {
+        y_dc.fill(0);
+        y_ac.fill(0);
+        uv_dc.fill(0);
+        uv_ac.fill(0);
+    }
+
+    // baseline 可能出現的 symbol 頻率至少補到 1: DC 的 category 0 ~ 11, AC 的 EOB、ZRL 跟 run 0 ~ 15 / size 1 ~ 10
+    // 只統計一部分 block 建表時用, 沒統計到的 symbol 也會有 code
+    void cover_all_symbols(bool chroma) {
+        cover(y_dc, y_ac);
+        if (chroma) {
+            cover(uv_dc, uv_ac);
+        }
+    }
+
+private:
+    static void cover(std::array<uint32_t, 256> &dc, std::array<uint32_t, 256> &ac) {
+        for (int category = 0; category <= 11; category++) {
+            dc[category] = std::max(dc[category], 1u);
+        }
+        ac[0x00] = std::max(ac[0x00], 1u);
+        ac[0xF0] = std::max(ac[0xF0], 1u);
+        for (int run = 0; run < 16; run++) {
+            for (int size = 1; size <= 10; size++) {
+                ac[run << 4 | size] = std::max(ac[run << 4 | size], 1u);
+            }
+        }
+    }
+};
+
+// 一張圖用到的四張表
+struct Jpeg_huffman_tables {
+    Jpeg_huffman_table y_dc, y_ac, uv_dc, uv_ac;
+
+    static Jpeg_huffman_tables from_frequencies(const Jpeg_huffman_frequencies &frequencies) {
+        return {Jpeg_huffman_table::from_frequencies(frequencies.y_dc),
+                Jpeg_huffman_table::from_frequencies(frequencies.y_ac),
+                Jpeg_huffman_table::from_frequencies(frequencies.uv_dc),
+                Jpeg_huffman_table::from_frequencies(frequencies.uv_ac)};
+    }
+
+    // ITU T.81 Annex K.3 的典型表, 不需要統計就能直接編碼
+    static constexpr const Jpeg_huffman_tables &standard();
+};
+
+namespace jpeg_annex_k {
+/* clang-format off */
+inline constexpr std::array<uint8_t, 16> luma_dc_bits = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+inline constexpr std::array<uint8_t, 12> luma_dc_values = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+inline constexpr std::array<uint8_t, 16> chroma_dc_bits = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+inline constexpr std::array<uint8_t, 12> chroma_dc_values = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+inline constexpr std::array<uint8_t, 16> luma_ac_bits = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+inline constexpr std::array<uint8_t, 162> luma_ac_values = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa};
+
+inline constexpr std::array<uint8_t, 16> chroma_ac_bits = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+inline constexpr std::array<uint8_t, 162> chroma_ac_values = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa};
+/* clang-format on */
+
+inline constexpr Jpeg_huffman_tables tables = {
+    Jpeg_huffman_table(luma_dc_bits, luma_dc_values),
+    Jpeg_huffman_table(luma_ac_bits, luma_ac_values),
+    Jpeg_huffman_table(chroma_dc_bits, chroma_dc_values),
+    Jpeg_huffman_table(chroma_ac_bits, chroma_ac_values),
+};
+}  // namespace jpeg_annex_k
+
+constexpr const Jpeg_huffman_tables &Jpeg_huffman_tables::standard() {
+    return jpeg_annex_k::tables;
+}
+
+}  // namespace f9ay
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "jpeg_bit_writer.hpp"
+#include "jpeg_huffman.hpp"
+
+namespace f9ay {
+
+// progressive JPEG (SOF2) 的一個 scan
+// components: 這個 scan 包含的 component (0 = Y, 1 = Cb, 2 = Cr), 由小到大排列
+// [ss, se]: zigzag 的頻段, DC scan 是 [0, 0] 可以包含多個 component, AC scan 只能有一個 component
+// ah / al: successive approximation, 第一次送出 al 以上的 bit (ah = 0), 之後每個 refine scan 多送一個 bit (ah = al + 1)
+struct Jpeg_scan {
+    std::vector<int> components;
+    int ss = 0, se = 0;
+    int ah = 0, al = 0;
+
+    // 跟 libjpeg 的 jpeg_simple_progression 一樣
+    // 第一個 scan 只有 DC 就能畫出 1/8 的預覽, 接著是 Y 的低頻
+    // component_count = 1 是灰階用的版本
+    static std::vector<Jpeg_scan> default_script(int component_count = 3) {
+        if (component_count == 1) {
+            return {
+                {{0}, 0, 0, 0, 1},   //
+                {{0}, 1, 5, 0, 2},   //
+                {{0}, 6, 63, 0, 2},  //
+                {{0}, 1, 63, 2, 1},  //
+                {{0}, 0, 0, 1, 0},   //
+                {{0}, 1, 63, 1, 0},  //
+            };
+        }
+        return {
+            {{0, 1, 2}, 0, 0, 0, 1},  //
+            {{0}, 1, 5, 0, 2},        //
+            {{2}, 1, 63, 0, 1},       //
+            {{1}, 1, 63, 0, 1},       //
+            {{0}, 6, 63, 0, 2},       //
+            {{0}, 1, 63, 2, 1},       //
+            {{0, 1, 2}, 0, 0, 1, 0},  //
+            {{2}, 1, 63, 1, 0},       //
+            {{1}, 1, 63, 1, 0},       //
+            {{0}, 1, 63, 1, 0},       //
+        };
+    }
+
+    // 檢查 scan 的順序是否合法 (T.81 G.1.1.1), 每個 component 的 DC 至少要送過一次
+    static void validate_script(const std::vector<Jpeg_scan> &script, int component_count = 3) {
+        // 每個係數目前送到第幾個 bit, -1 代表還沒送過
+        std::array<std::array<int, 64>, 3> last_bit;
+        for (auto &component : last_bit) {
+            component.fill(-1);
+        }
+        for (const auto &scan : script) {
+            if (scan.components.empty() || scan.components.size() > static_cast<std::size_t>(component_count)) {
+                throw std::invalid_argument("invalid scan script: bad component count");
+            }
+            for (std::size_t i = 0; i < scan.components.size(); i++) {
+                if (scan.components[i] < 0 || scan.components[i] >= component_count ||
+                    (i > 0 && scan.components[i] <= scan.components[i - 1])) {
+                    throw std::invalid_argument("invalid scan script: bad component index");
+                }
+            }
+            if (scan.ss < 0 || scan.se > 63 || scan.ss > scan.se || (scan.ss == 0 && scan.se != 0) ||
+                (scan.ss > 0 && scan.components.size() != 1)) {
+                throw std::invalid_argument("invalid scan script: bad spectral selection");
+            }
+            if (scan.al < 0 || scan.al > 13 || (scan.ah != 0 && scan.ah != scan.al + 1)) {
+                throw std::invalid_argument("invalid scan script: bad successive approximation");
+            }
+            for (const int component : scan.components) {
+                auto &bits = last_bit[component];
+                if (scan.ss > 0 && bits[0] < 0) {
+                    throw std::invalid_argument("invalid scan script: AC scan before DC scan");
+                }
+                for (int k = scan.ss; k <= scan.se; k++) {
+                    if (scan.ah == 0 ? bits[k] >= 0 : bits[k] != scan.ah) {
+                        throw std::invalid_argument("invalid scan script: bad successive approximation");
+                    }
+                    bits[k] = scan.al;
+                }
+            }
+        }
+        for (int component = 0; component < component_count; component++) {
+            if (last_bit[component][0] < 0) {
+                throw std::invalid_argument("invalid scan script: missing DC scan");
+            }
+        }
+    }
+};
+
+// 只統計 symbol 頻率, 給第一趟建 huffman 表用
+// 表 0 給 Y, 表 1 給 Cb Cr, DC 還是 AC 由 scan 決定
+// 跟 sequential 一樣用固定大小的陣列統計, 建出來的表跟標準函式庫的實作無關
+struct Jpeg_scan_statistics {
+    std::array<std::array<uint32_t, 256>, 2> frequencies{};
+
+    void symbol(int table, uint8_t value) {
+        frequencies[table][value]++;
+    }
+
+    void bits(uint32_t, int) {}
+
+    // 沒有用到的表是空的
+    std::array<Jpeg_huffman_table, 2> build() const {
+        return {Jpeg_huffman_table::from_frequencies(frequencies[0]),
+                Jpeg_huffman_table::from_frequencies(frequencies[1])};
+    }
+};
+
+// 用建好的表真正寫出
+struct Jpeg_scan_writer {
+    Jpeg_bit_writer &bit_writer;
+    const std::array<Jpeg_huffman_table, 2> &tables;
+
+    void symbol(int table, uint8_t value) {
+        const auto code = tables[table].getMapping(value);
+        bit_writer.write(code.value, code.length);
+    }
+
+    void bits(uint32_t value, int count) {
+        bit_writer.write(value, count);
+    }
+};
+
+// 一個 progressive scan 的熵編碼 (T.81 G.1.2), 照 scan 的順序把量化後的 zigzag block 一個一個丟進來
+// Sink 是 Jpeg_scan_statistics 或 Jpeg_scan_writer, 兩趟跑一樣的流程所以統計跟輸出的 symbol 完全一致
+template <typename Sink>
+class Jpeg_scan_encoder {
+public:
+    Jpeg_scan_encoder(const Jpeg_scan &scan, Sink &sink) : scan(scan), sink(sink) {}
+
+    void encode(int component, const std::array<int, 64> &block) {
+        const int table = component == 0 ? 0 : 1;
+        if (scan.ss == 0) {
+            if (scan.ah == 0) {
+                encode_dc_first(component, table, block);
+            } else {
+                sink.bits((block[0] >> scan.al) & 1, 1);
+            }
+        } else if (scan.ah == 0) {
+            encode_ac_first(table, block);
+        } else {
+            encode_ac_refine(table, block);
+        }
+    }
+
+    // scan 結束時把還沒送出的 EOBRUN 送出
+    void finish() {
+        emit_eobrun();
+    }
+
+private:
+    // EOBRUN 最多 0x7FFF, refine 時 EOBRUN 範圍內的 correction bit 要暫存到 EOBRUN 送出之後 (libjpeg 的上限是 1000)
+    static constexpr int max_eobrun = 0x7FFF;
+    static constexpr int max_correction_bits = 1000;
+
+    const Jpeg_scan &scan;
+    Sink &sink;
+    std::array<int, 3> last_dc{};
+    int eobrun = 0;
+    int eobrun_table = 0;
+    std::vector<uint8_t> correction_bits;
+
+    static int bit_length(int x) {
+        return std::bit_width(static_cast<unsigned>(x));
+    }
+
+    void encode_dc_first(int component, int table, const std::array<int, 64> &block) {
+        const int dc = block[0] >> scan.al;
+        const int diff = dc - last_dc[component];
+        last_dc[component] = dc;
+        const int size = bit_length(diff < 0 ? -diff : diff);
+        sink.symbol(table, size);
+        if (size > 0) {
+            sink.bits(diff < 0 ? diff + (1 << size) - 1 : diff, size);
+        }
+    }
+
+    void encode_ac_first(int table, const std::array<int, 64> &block) {
+        int run = 0;
+        for (int k = scan.ss; k <= scan.se; k++) {
+            int value = block[k];
+            const bool negative = value < 0;
+            value = (negative ? -value : value) >> scan.al;
+            if (value == 0) {
+                run++;
+                continue;
+            }
+            emit_eobrun();
+            for (; run > 15; run -= 16) {
+                sink.symbol(table, 0xF0);  // ZRL
+            }
+            const int size = bit_length(value);
+            sink.symbol(table, run << 4 | size);
+            sink.bits(negative ? ~value & ((1 << size) - 1) : value, size);
+            run = 0;
+        }
+        if (run > 0) {
+            eobrun_table = table;
+            if (++eobrun == max_eobrun) {
+                emit_eobrun();
+            }
+        }
+    }
+
+    void encode_ac_refine(int table, const std::array<int, 64> &block) {
+        std::array<int, 64> magnitude;  // NOLINT(*-pro-type-member-init)
+        int last_new = 0;  // 最後一個這次才變成非 0 的係數
+        for (int k = scan.ss; k <= scan.se; k++) {
+            magnitude[k] = (block[k] < 0 ? -block[k] : block[k]) >> scan.al;
+            if (magnitude[k] == 1) {
+                last_new = k;
+            }
+        }
+
+        // 之前就非 0 的係數在這個 block 裡累積的 correction bit, 接在 EOBRUN 的 bit 後面
+        std::size_t pending = correction_bits.size();
+        int run = 0;
+        for (int k = scan.ss; k <= scan.se; k++) {
+            if (magnitude[k] == 0) {
+                run++;
+                continue;
+            }
+            while (run > 15 && k <= last_new) {
+                emit_eobrun_bits(pending);
+                sink.symbol(table, 0xF0);  // ZRL
+                run -= 16;
+                emit_correction_bits(pending);
+            }
+            if (magnitude[k] > 1) {
+                correction_bits.push_back(magnitude[k] & 1);
+                continue;
+            }
+            emit_eobrun_bits(pending);
+            sink.symbol(table, run << 4 | 1);
+            sink.bits(block[k] < 0 ? 0 : 1, 1);
+            emit_correction_bits(pending);
+            run = 0;
+        }
+        if (run > 0 || correction_bits.size() > pending) {
+            // 剩下的 correction bit 留給 EOBRUN
+            eobrun_table = table;
+            const int buffered = static_cast<int>(correction_bits.size());
+            if (++eobrun == max_eobrun || buffered > max_correction_bits - 64 + 1) {
+                emit_eobrun();
+            }
+        }
+    }
+
+    // 送出 EOBRUN 以及它範圍內暫存的 correction bit, 保留 [pending, end) 這段目前 block 的 bit
+    void emit_eobrun_bits(std::size_t &pending) {
+        if (eobrun == 0) {
+            return;
+        }
+        emit_eobrun_symbol();
+        for (std::size_t i = 0; i < pending; i++) {
+            sink.bits(correction_bits[i], 1);
+        }
+        correction_bits.erase(correction_bits.begin(), correction_bits.begin() + pending);
+        pending = 0;
+    }
+
+    // 送出目前 block 累積的 correction bit
+    void emit_correction_bits(std::size_t pending) {
+        for (std::size_t i = pending; i < correction_bits.size(); i++) {
+            sink.bits(correction_bits[i], 1);
+        }
+        correction_bits.resize(pending);
+    }
+
+    void emit_eobrun() {
+        std::size_t pending = correction_bits.size();
+        emit_eobrun_bits(pending);
+    }
+
+    void emit_eobrun_symbol() {
+        const int size = bit_length(eobrun) - 1;
+        sink.symbol(eobrun_table, size << 4);
+        if (size > 0) {
+            sink.bits(eobrun & ((1 << size) - 1), size);
+        }
+        eobrun = 0;
+    }
+};
+
+}  // namespace f9ay
@@ -0,0 +1,259 @@
+#pragma once
+#include <immintrin.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "dct.hpp"
+
+namespace f9ay {
+
+using Jpeg_quant_matrix = std::array<std::array<uint8_t, 8>, 8>;
+
+// zigzag 的第 k 個係數在 8x8 block (row-major) 裡的位置
+// 沿著反對角線來回走: 奇數條 row 遞增, 偶數條 row 遞減
+consteval std::array<uint8_t, 64> make_jpeg_natural_order() {
+    std::array<uint8_t, 64> order{};
+    int k = 0;
+    for (int diagonal = 0; diagonal < 15; diagonal++) {
+        const int first = std::max(0, diagonal - 7);
+        const int last = std::min(diagonal, 7);
+        for (int t = first; t <= last; t++) {
+            const int row = diagonal % 2 == 1 ? t : first + last - t;
+            order[k++] = static_cast<uint8_t>(row * 8 + diagonal - row);
+        }
+    }
+    return order;
+}
+
+inline constexpr std::array<uint8_t, 64> jpeg_natural_order = make_jpeg_natural_order();
+
+// 一張量化表, 建構時就把除法換成倒數乘法, 參數依 zigzag 順序排好
+//   整數係數: round(x / q) = sign(x) * ((|x| + q / 2) * multiplier >> shift), |x| < 2^14 時跟除法完全一樣
+//   AAN 係數: round(x / (q * AAN 縮放)) = sign(x) * ((|x| * aan_multiplier + 2^(aan_shift - 1)) >> aan_shift)
+//            aan_multiplier 落在 [2^15, 2^16), 全部是 32 bit 整數運算, 不同的編譯選項跟 AVX2 與否結果都一樣
+// quantize_zigzag 一趟就把 DCT 的輸出 (row-major) 變成 zigzag 順序的量化係數
+class Jpeg_quant_table {
+public:
+    static constexpr int max_abs = (1 << 14) - 256;  // 超過的係數會被 clamp, 正常的 DCT 輸出不會超過 2^11
+    static constexpr int aan_max_abs = (1 << 15) - 1;  // Dct_aan 的輸出放大了 16 倍, 正常不會超過 2^15
+
+    Jpeg_quant_matrix matrix;  // row-major, 寫進 DQT 的值
+
+    explicit constexpr Jpeg_quant_table(const Jpeg_quant_matrix &quant_matrix) : matrix(quant_matrix) {
+        for (int k = 0; k < 64; k++) {
+            const int natural = jpeg_natural_order[k];
+            const int q = matrix[natural / 8][natural % 8];
+            const int s = 14 + std::bit_width(static_cast<unsigned>(q - 1));  // 14 + ceil(log2(q))
+            multiplier[k] = static_cast<int32_t>(((int64_t{1} << s) + q - 1) / q);
+            shift[k] = s;
+            half[k] = q / 2;
+
+            // 找最小的 aan_shift 讓 aan_multiplier >= 2^15, 乘上 |x| < 2^15 仍然在 32 bit 以內
+            const int64_t divisor = q * Dct_aan::fixed_scale[natural];
+            int64_t m = 0;
+            int aan_s = 0;
+            for (;; aan_s++) {
+                m = ((int64_t{1} << (aan_s + Dct_aan::scale_bits)) + divisor / 2) / divisor;
+                if (m >= 1 << 15) {
+                    break;
+                }
+            }
+            aan_multiplier[k] = static_cast<int32_t>(m);
+            aan_shift[k] = aan_s;
+            aan_round[k] = 1 << (aan_s - 1);
+        }
+    }
+
+    // Jpeg_dct::float_matrix 的輸出量化後以 zigzag 順序寫到 out
+    void quantize_zigzag(const std::array<int, 64> &block, std::array<int, 64> &out) const {
+#ifdef __AVX2__
+        const auto limit = _mm256_set1_epi32(max_abs);
+        for (int k = 0; k < 64; k += 8) {
+            const auto x = gather(block, k);
+            auto n = _mm256_add_epi32(_mm256_min_epi32(_mm256_abs_epi32(x), limit), load(&half[k]));
+            n = _mm256_srlv_epi32(_mm256_mullo_epi32(n, load(&multiplier[k])), load(&shift[k]));
+            store(&out[k], _mm256_sign_epi32(n, x));
+        }
+#else
+        for (int k = 0; k < 64; k++) {
+            const int x = block[jpeg_natural_order[k]];
+            const int n = (std::min(std::abs(x), max_abs) + half[k]) * multiplier[k] >> shift[k];
+            out[k] = x < 0 ? -n : n;
+        }
+#endif
+    }
+
+    // Jpeg_dct::aan_integer 的輸出量化後以 zigzag 順序寫到 out
+    void quantize_aan_zigzag(const std::array<int, 64> &block, std::array<int, 64> &out) const {
+#ifdef __AVX2__
+        const auto limit = _mm256_set1_epi32(aan_max_abs);
+        for (int k = 0; k < 64; k += 8) {
+            const auto x = gather(block, k);
+            // 乘積加上 round 最多 2^31 + 2^28, 當成 unsigned 右移
+            auto n = _mm256_mullo_epi32(_mm256_min_epi32(_mm256_abs_epi32(x), limit), load(&aan_multiplier[k]));
+            n = _mm256_srlv_epi32(_mm256_add_epi32(n, load(&aan_round[k])), load(&aan_shift[k]));
+            store(&out[k], _mm256_sign_epi32(n, x));
+        }
+#else
+        for (int k = 0; k < 64; k++) {
+            const int x = block[jpeg_natural_order[k]];
+            const auto a = static_cast<uint32_t>(std::min(std::abs(x), aan_max_abs));
+            const auto n = (a * static_cast<uint32_t>(aan_multiplier[k]) + aan_round[k]) >> aan_shift[k];
+            out[k] = x < 0 ? -static_cast<int>(n) : static_cast<int>(n);
+        }
+#endif
+    }
+
+    // 原地量化, 結果維持 row-major
+    void quantize(std::array<int, 64> &block) const {
+        std::array<int, 64> zigzag;  // NOLINT(*-pro-type-member-init)
+        quantize_zigzag(block, zigzag);
+        to_natural_order(zigzag, block);
+    }
+
+    void quantize_aan(std::array<int, 64> &block) const {
+        std::array<int, 64> zigzag;  // NOLINT(*-pro-type-member-init)
+        quantize_aan_zigzag(block, zigzag);
+        to_natural_order(zigzag, block);
+    }
+
+private:
+    alignas(32) std::array<int32_t, 64> multiplier{};
+    alignas(32) std::array<int32_t, 64> shift{};
+    alignas(32) std::array<int32_t, 64> half{};
+    alignas(32) std::array<int32_t, 64> aan_multiplier{};
+    alignas(32) std::array<int32_t, 64> aan_shift{};
+    alignas(32) std::array<int32_t, 64> aan_round{};
+
+    static void to_natural_order(const std::array<int, 64> &zigzag, std::array<int, 64> &block) {
+        for (int k = 0; k < 64; k++) {
+            block[jpeg_natural_order[k]] = zigzag[k];
+        }
+    }
+
+#ifdef __AVX2__
+    static constexpr auto natural_index = [] {
+        std::array<int32_t, 64> index{};
+        for (int k = 0; k < 64; k++) {
+            index[k] = jpeg_natural_order[k];
+        }
+        return index;
+    }();
+
+    // 依 jpeg_natural_order 取出 zigzag 第 k ~ k + 7 個係數
+    static __m256i gather(const std::array<int, 64> &block, int k) {
+        return _mm256_i32gather_epi32(block.data(), load(&natural_index[k]), 4);
+    }
+    static __m256i load(const int32_t *p) {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    }
+    static void store(int32_t *p, __m256i v) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v);
+    }
+#endif
+};
+
+// 亮度跟色度兩張表
+struct Jpeg_quant_tables {
+    Jpeg_quant_table luma;
+    Jpeg_quant_table chroma;
+
+    // quality 1 ~ 100 跟 libjpeg 的 jpeg_set_quality 一樣縮放 Annex K 的表, 0 代表使用內建的表
+    // 每個 quality 只會算一次
+    static const Jpeg_quant_tables &get(int quality) {
+        if (quality < 0 || quality > 100) [[unlikely]] {
+            throw std::invalid_argument("jpeg quality must be in [0, 100]");
+        }
+        static const auto cache = [] {
+            std::vector<Jpeg_quant_tables> tables;
+            tables.reserve(101);
+            tables.push_back({Jpeg_quant_table(default_luma), Jpeg_quant_table(default_chroma)});
+            for (int q = 1; q <= 100; q++) {
+                tables.push_back(
+                    {Jpeg_quant_table(scale(annex_k_luma, q)), Jpeg_quant_table(scale(annex_k_chroma, q))});
+            }
+            return tables;
+        }();
+        return cache[quality];
+    }
+
+    static constexpr Jpeg_quant_matrix scale(const Jpeg_quant_matrix &base, int quality) {
+        const int factor = quality < 50 ? 5000 / quality : 200 - quality * 2;
+        Jpeg_quant_matrix result{};
+        for (int i = 0; i < 8; i++) {
+            for (int j = 0; j < 8; j++) {
+                result[i][j] = std::clamp((base[i][j] * factor + 50) / 100, 1, 255);
+            }
+        }
+        return result;
+    }
+
+    // ITU T.81 Annex K.1
+    static constexpr Jpeg_quant_matrix annex_k_luma = {
+        std::array<uint8_t, 8>{16, 11, 10, 16, 24, 40, 51, 61},
+        {12, 12, 14, 19, 26, 58, 60, 55},
+        {14, 13, 16, 24, 40, 57, 69, 56},
+        {14, 17, 22, 29, 51, 87, 80, 62},
+        {18, 22, 37, 56, 68, 109, 103, 77},
+        {24, 35, 55, 64, 81, 104, 113, 92},
+        {49, 64, 78, 87, 103, 121, 120, 101},
+        {72, 92, 95, 98, 112, 100, 103, 99}};
+
+    static constexpr Jpeg_quant_matrix annex_k_chroma = {
+        std::array<uint8_t, 8>{17, 18, 24, 47, 99, 99, 99, 99},
+        {18, 21, 26, 66, 99, 99, 99, 99},
+        {24, 26, 56, 99, 99, 99, 99, 99},
+        {47, 66, 99, 99, 99, 99, 99, 99},
+        {99, 99, 99, 99, 99, 99, 99, 99},
+        {99, 99, 99, 99, 99, 99, 99, 99},
+        {99, 99, 99, 99, 99, 99, 99, 99},
+        {99, 99, 99, 99, 99, 99, 99, 99}};
+
+    /*DQT, Row #0:   2   1   1   2   3   5   6   7
+    DQT, Row #1:   1   1   2   2   3   7   7   7
+    DQT, Row #2:   2   2   2   3   5   7   8   7
+    DQT, Row #3:   2   2   3   3   6  10  10   7
+    DQT, Row #4:   2   3   4   7   8  13  12   9
+    DQT, Row #5:   3   4   7   8  10  12  14  11
+    DQT, Row #6:   6   8   9  10  12  15  14  12
+    DQT, Row #7:   9  11  11  12  13  12  12  12
+*/
+    static constexpr Jpeg_quant_matrix default_luma = {
+        std::array<uint8_t, 8>{2, 1, 1, 2, 3, 5, 6, 7},
+        {1, 1, 2, 2, 3, 7, 7, 7},
+        {2, 2, 2, 3, 5, 7, 8, 7},
+        {2, 2, 3, 3, 6, 10, 10, 7},
+        {2, 3, 4, 7, 8, 13, 12, 9},
+        {3, 4, 7, 8, 10, 12, 14, 11},
+        {6, 8, 9, 10, 12, 15, 14, 12},
+        {9, 11, 11, 12, 13, 12, 12, 12}};
+
+    /*  Precision=8 bits
+  Destination ID=1 (Chrominance)
+    DQT, Row #0:   2   2   3   6  12  12  12  12
+    DQT, Row #1:   2   3   3   8  12  12  12  12
+    DQT, Row #2:   3   3   7  12  12  12  12  12
+    DQT, Row #3:   6   8  12  12  12  12  12  12
+    DQT, Row #4:  12  12  12  12  12  12  12  12
+    DQT, Row #5:  12  12  12  12  12  12  12  12
+    DQT, Row #6:  12  12  12  12  12  12  12  12
+    DQT, Row #7:  12  12  12  12  12  12  12  12
+    Approx quality factor = 93.93 (scaling=12.14 variance*/
+    static constexpr Jpeg_quant_matrix default_chroma = {
+        std::array<uint8_t, 8>{2, 2, 3, 6, 12, 12, 12, 12},
+        {2, 3, 3, 8, 12, 12, 12, 12},
+        {3, 3, 7, 12, 12, 12, 12, 12},
+        {6, 8, 12, 12, 12, 12, 12, 12},
+        {12, 12, 12, 12, 12, 12, 12, 12},
+        {12, 12, 12, 12, 12, 12, 12, 12},
+        {12, 12, 12, 12, 12, 12, 12, 12},
+        {12, 12, 12, 12, 12, 12, 12, 12}};
+};
+
+}  // namespace f9ay
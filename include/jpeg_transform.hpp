@@ -0,0 +1,381 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "jpeg_bit_writer.hpp"
+#include "jpeg_decoder.hpp"
+#include "jpeg_huffman.hpp"
+#include "jpeg_progressive.hpp"
+
+namespace f9ay {
+
+enum class Jpeg_transform {
+    none,
+    flip_horizontal,  // 左右鏡像
+    flip_vertical,    // 上下鏡像
+    transpose,        // 沿左上 - 右下的對角線翻轉
+    transverse,       // 沿右上 - 左下的對角線翻轉
+    rotate_90,        // 順時針
+    rotate_180,
+    rotate_270,
+};
+
+struct Jpeg_transform_options {
+    Jpeg_transform transform = Jpeg_transform::none;
+    // 在轉換後的圖上裁切, 左上角必須對齊 MCU, 寬高是 0 代表到圖的邊緣
+    int crop_x = 0, crop_y = 0;
+    int crop_width = 0, crop_height = 0;
+};
+
+// 不解到 pixel 的無損轉換: 熵解碼出量化後的係數, 搬動 block 並翻轉係數的正負號, 再重新熵編碼
+// 鏡像後原本在右邊 / 下面補齊 MCU 的 block 會跑到圖的另一邊, 所以被鏡像的方向會先裁到 MCU 的倍數 (jpegtran -trim)
+// 量化表跟著係數轉置, 輸出是用最佳化 huffman 表的 baseline JPEG, 不保留 APPn 等其他 segment
+class Jpeg_transformer {
+public:
+    static std::pair<std::unique_ptr<std::byte[]>, size_t> transform(const std::byte *source, std::size_t size,
+                                                                     const Jpeg_transform_options &options = {}) {
+        auto coefficients = Jpeg_decoder::read_coefficients(source, size);
+        const auto result = apply(coefficients, options);
+        return encode(result);
+    }
+
+    // 每個 transform 都可以拆成: 先看要不要轉置, 再對轉置後的圖做左右 / 上下鏡像
+    struct Steps {
+        bool transpose = false;
+        bool flip_x = false;
+        bool flip_y = false;
+    };
+
+    static constexpr Steps steps(Jpeg_transform transform) {
+        switch (transform) {
+            case Jpeg_transform::flip_horizontal:
+                return {false, true, false};
+            case Jpeg_transform::flip_vertical:
+                return {false, false, true};
+            case Jpeg_transform::transpose:
+                return {true, false, false};
+            case Jpeg_transform::transverse:
+                return {true, true, true};
+            case Jpeg_transform::rotate_90:
+                return {true, true, false};
+            case Jpeg_transform::rotate_180:
+                return {false, true, true};
+            case Jpeg_transform::rotate_270:
+                return {true, false, true};
+            default:
+                return {};
+        }
+    }
+
+    static Jpeg_coefficients apply(const Jpeg_coefficients &src, const Jpeg_transform_options &options) {
+        const auto [transpose, flip_x, flip_y] = steps(options.transform);
+
+        int h_max = 1, v_max = 1;
+        for (const auto &component : src.components) {
+            h_max = std::max(h_max, transpose ? component.v : component.h);
+            v_max = std::max(v_max, transpose ? component.h : component.v);
+        }
+        const int mcu_width = 8 * h_max;
+        const int mcu_height = 8 * v_max;
+
+        // 轉置後的大小, 被鏡像的方向捨去不滿一個 MCU 的部分
+        int width = transpose ? src.height : src.width;
+        int height = transpose ? src.width : src.height;
+        if (flip_x) {
+            width = width / mcu_width * mcu_width;
+        }
+        if (flip_y) {
+            height = height / mcu_height * mcu_height;
+        }
+        if (width == 0 || height == 0) {
+            throw std::invalid_argument("JPEG transform: image is smaller than one MCU in the flipped direction");
+        }
+        // 鏡像時以裁好的大小為準, 之後再裁切
+        const int flipped_mcus_x = width / mcu_width;
+        const int flipped_mcus_y = height / mcu_height;
+
+        if (options.crop_x < 0 || options.crop_y < 0 || options.crop_width < 0 || options.crop_height < 0 ||
+            options.crop_x % mcu_width != 0 || options.crop_y % mcu_height != 0 || options.crop_x >= width ||
+            options.crop_y >= height) {
+            throw std::invalid_argument("JPEG transform: crop origin must be MCU aligned and inside the image");
+        }
+        const int crop_width = options.crop_width == 0 ? width - options.crop_x : options.crop_width;
+        const int crop_height = options.crop_height == 0 ? height - options.crop_y : options.crop_height;
+
+        Jpeg_coefficients dst;
+        dst.width = std::min(crop_width, width - options.crop_x);
+        dst.height = std::min(crop_height, height - options.crop_y);
+        const int mcus_x = (dst.width + mcu_width - 1) / mcu_width;
+        const int mcus_y = (dst.height + mcu_height - 1) / mcu_height;
+
+        // 轉置時係數 (u, v) 用的是原本 (v, u) 的量化值
+        dst.quant_defined = src.quant_defined;
+        for (int t = 0; t < 4; t++) {
+            for (int k = 0; k < 64; k++) {
+                dst.quant_tables[t][k] = src.quant_tables[t][coefficient_map(transpose, k)];
+            }
+        }
+
+        // 輸出的第 k 個 zigzag 係數從哪裡來, 負號代表要反相
+        std::array<int, 64> source_index;
+        std::array<bool, 64> negate;
+        for (int k = 0; k < 64; k++) {
+            const int u = jpeg_natural_order[k] / 8;
+            const int v = jpeg_natural_order[k] % 8;
+            source_index[k] = coefficient_map(transpose, k);
+            // 水平鏡像讓水平頻率是奇數的 cosine 反相, 垂直同理
+            negate[k] = (flip_x && v % 2 == 1) != (flip_y && u % 2 == 1);
+        }
+
+        for (const auto &component : src.components) {
+            auto &out = dst.components.emplace_back();
+            out.id = component.id;
+            out.h = transpose ? component.v : component.h;
+            out.v = transpose ? component.h : component.v;
+            out.quant_table = component.quant_table;
+            out.blocks_width = mcus_x * out.h;
+            out.blocks_height = mcus_y * out.v;
+            out.blocks.resize(static_cast<std::size_t>(out.blocks_width) * out.blocks_height);
+
+            const int offset_x = options.crop_x / mcu_width * out.h;
+            const int offset_y = options.crop_y / mcu_height * out.v;
+            const int flipped_width = flipped_mcus_x * out.h;
+            const int flipped_height = flipped_mcus_y * out.v;
+            for (int i = 0; i < out.blocks_height; i++) {
+                for (int j = 0; j < out.blocks_width; j++) {
+                    // 在轉置後 (還沒裁切) 的圖上的位置, 超出圖的 block 不會被看到, 直接用邊緣的 block
+                    int row = i + offset_y;
+                    int col = j + offset_x;
+                    if (flip_x) {
+                        col = std::max(flipped_width - 1 - col, 0);
+                    }
+                    if (flip_y) {
+                        row = std::max(flipped_height - 1 - row, 0);
+                    }
+                    int src_row = transpose ? col : row;
+                    int src_col = transpose ? row : col;
+                    src_row = std::min(src_row, component.blocks_height - 1);
+                    src_col = std::min(src_col, component.blocks_width - 1);
+
+                    const auto &in = component.at(src_row, src_col);
+                    auto &block = out.at(i, j);
+                    for (int k = 0; k < 64; k++) {
+                        const int16_t value = in[source_index[k]];
+                        block[k] = negate[k] ? static_cast<int16_t>(-value) : value;
+                    }
+                }
+            }
+        }
+        return dst;
+    }
+
+    // 把係數寫成 baseline JPEG, 第 0 個 component 用 huffman 表 0, 其他用表 1
+    static std::pair<std::unique_ptr<std::byte[]>, size_t> encode(const Jpeg_coefficients &image) {
+        const int mcus_x = image.components[0].blocks_width / image.components[0].h;
+        const int mcus_y = image.components[0].blocks_height / image.components[0].v;
+
+        // 跟解碼時一樣, 只有一個 component 的 scan 是不交錯的, 只包含圖片範圍內的 block
+        auto for_each_block = [&](auto &&on_block) {
+            if (image.components.size() == 1) {
+                const auto &component = image.components[0];
+                for (int i = 0; i < (image.height + 7) / 8; i++) {
+                    for (int j = 0; j < (image.width + 7) / 8; j++) {
+                        on_block(0, component.at(i, j));
+                    }
+                }
+                return;
+            }
+            for (int mcu_row = 0; mcu_row < mcus_y; mcu_row++) {
+                for (int mcu_col = 0; mcu_col < mcus_x; mcu_col++) {
+                    for (std::size_t c = 0; c < image.components.size(); c++) {
+                        const auto &component = image.components[c];
+                        for (int i = 0; i < component.v; i++) {
+                            for (int j = 0; j < component.h; j++) {
+                                on_block(c, component.at(mcu_row * component.v + i, mcu_col * component.h + j));
+                            }
+                        }
+                    }
+                }
+            }
+        };
+
+        Jpeg_scan_statistics dc_statistics, ac_statistics;
+        {
+            std::array<int, 4> last_dc{};
+            for_each_block([&](int component, const Jpeg_coefficients::block_t &block) {
+                encode_block(block, component == 0 ? 0 : 1, last_dc[component], dc_statistics, ac_statistics);
+            });
+        }
+        const auto dc_tables = dc_statistics.build();
+        const auto ac_tables = ac_statistics.build();
+
+        std::vector<std::byte> buffer;
+        put_u16(buffer, 0xFFD8);
+        write_dqt(buffer, image);
+        write_sof(buffer, image);
+        write_dht(buffer, image, dc_tables, ac_tables);
+        write_sos(buffer, image);
+        {
+            Jpeg_bit_writer bit_writer(buffer);
+            Jpeg_scan_writer dc_writer{bit_writer, dc_tables};
+            Jpeg_scan_writer ac_writer{bit_writer, ac_tables};
+            std::array<int, 4> last_dc{};
+            for_each_block([&](int component, const Jpeg_coefficients::block_t &block) {
+                encode_block(block, component == 0 ? 0 : 1, last_dc[component], dc_writer, ac_writer);
+            });
+            bit_writer.flush();
+        }
+        put_u16(buffer, 0xFFD9);
+
+        std::unique_ptr<std::byte[]> result(new std::byte[buffer.size()]);
+        std::copy(buffer.begin(), buffer.end(), result.get());
+        return {std::move(result), buffer.size()};
+    }
+
+private:
+    // 轉置時輸出的第 k 個 zigzag 係數對應到輸入的哪一個
+    static int coefficient_map(bool transpose, int k) {
+        if (!transpose) {
+            return k;
+        }
+        const int natural = jpeg_natural_order[k];
+        const int transposed = natural % 8 * 8 + natural / 8;
+        return static_cast<int>(std::ranges::find(jpeg_natural_order, transposed) - jpeg_natural_order.begin());
+    }
+
+    static int bit_length(int x) {
+        return std::bit_width(static_cast<unsigned>(x < 0 ? -x : x));
+    }
+
+    // baseline 的一個 block: DC 差值加上 AC 的 (run, size), Sink 跟 progressive 一樣是統計或寫出
+    template <typename Sink>
+    static void encode_block(const Jpeg_coefficients::block_t &block, int table, int &last_dc, Sink &dc, Sink &ac) {
+        const int diff = block[0] - last_dc;
+        last_dc = block[0];
+        const int dc_size = bit_length(diff);
+        dc.symbol(table, dc_size);
+        if (dc_size > 0) {
+            dc.bits(diff < 0 ? diff + (1 << dc_size) - 1 : diff, dc_size);
+        }
+
+        int run = 0;
+        for (int k = 1; k < 64; k++) {
+            const int value = block[k];
+            if (value == 0) {
+                run++;
+                continue;
+            }
+            for (; run > 15; run -= 16) {
+                ac.symbol(table, 0xF0);  // ZRL
+            }
+            const int size = bit_length(value);
+            ac.symbol(table, run << 4 | size);
+            ac.bits(value < 0 ? value + (1 << size) - 1 : value, size);
+            run = 0;
+        }
+        if (run > 0) {
+            ac.symbol(table, 0x00);  // EOB
+        }
+    }
+
+    static void put_u8(std::vector<std::byte> &buffer, int value) {
+        buffer.push_back(static_cast<std::byte>(value));
+    }
+
+    static void put_u16(std::vector<std::byte> &buffer, int value) {
+        put_u8(buffer, value >> 8);
+        put_u8(buffer, value & 0xFF);
+    }
+
+    // 先寫 marker 跟長度的位置, 回傳長度的 index, 寫完內容後用 end_segment 填回去
+    static std::size_t begin_segment(std::vector<std::byte> &buffer, int marker) {
+        put_u16(buffer, marker);
+        put_u16(buffer, 0);
+        return buffer.size() - 2;
+    }
+
+    static void end_segment(std::vector<std::byte> &buffer, std::size_t length_index) {
+        const auto length = buffer.size() - length_index;
+        buffer[length_index] = static_cast<std::byte>(length >> 8);
+        buffer[length_index + 1] = static_cast<std::byte>(length & 0xFF);
+    }
+
+    static void write_dqt(std::vector<std::byte> &buffer, const Jpeg_coefficients &image) {
+        const auto length_index = begin_segment(buffer, 0xFFDB);
+        for (int t = 0; t < 4; t++) {
+            const bool used = std::ranges::any_of(image.components, [t](const auto &component) {
+                return component.quant_table == t;
+            });
+            if (!used) {
+                continue;
+            }
+            const auto &table = image.quant_tables[t];
+            const bool precision = std::ranges::any_of(table, [](uint16_t q) {
+                return q > 0xFF;
+            });
+            put_u8(buffer, precision << 4 | t);
+            for (const auto q : table) {
+                precision ? put_u16(buffer, q) : put_u8(buffer, q);
+            }
+        }
+        end_segment(buffer, length_index);
+    }
+
+    static void write_sof(std::vector<std::byte> &buffer, const Jpeg_coefficients &image) {
+        const auto length_index = begin_segment(buffer, 0xFFC0);
+        put_u8(buffer, 8);  // precision
+        put_u16(buffer, image.height);
+        put_u16(buffer, image.width);
+        put_u8(buffer, static_cast<int>(image.components.size()));
+        for (const auto &component : image.components) {
+            put_u8(buffer, component.id);
+            put_u8(buffer, component.h << 4 | component.v);
+            put_u8(buffer, component.quant_table);
+        }
+        end_segment(buffer, length_index);
+    }
+
+    static void write_dht(std::vector<std::byte> &buffer, const Jpeg_coefficients &image,
+                          const std::array<Jpeg_huffman_table, 2> &dc_tables,
+                          const std::array<Jpeg_huffman_table, 2> &ac_tables) {
+        const auto length_index = begin_segment(buffer, 0xFFC4);
+        const int table_count = image.components.size() == 1 ? 1 : 2;
+        for (int table_class = 0; table_class < 2; table_class++) {
+            for (int id = 0; id < table_count; id++) {
+                const auto &table = (table_class == 0 ? dc_tables : ac_tables)[id];
+                put_u8(buffer, table_class << 4 | id);
+                for (const auto count : table.bits) {
+                    put_u8(buffer, count);
+                }
+                for (const auto symbol : table.symbols()) {
+                    put_u8(buffer, symbol);
+                }
+            }
+        }
+        end_segment(buffer, length_index);
+    }
+
+    static void write_sos(std::vector<std::byte> &buffer, const Jpeg_coefficients &image) {
+        const auto length_index = begin_segment(buffer, 0xFFDA);
+        put_u8(buffer, static_cast<int>(image.components.size()));
+        for (std::size_t c = 0; c < image.components.size(); c++) {
+            const int id = c == 0 ? 0 : 1;
+            put_u8(buffer, image.components[c].id);
+            put_u8(buffer, id << 4 | id);  // DC / AC huffman id
+        }
+        put_u8(buffer, 0);     // Ss
+        put_u8(buffer, 63);    // Se
+        put_u8(buffer, 0x00);  // Ah / Al
+        end_segment(buffer, length_index);
+    }
+};
+
+}  // namespace f9ay
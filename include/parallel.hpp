@@ -0,0 +1,61 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace f9ay {
+
+// 0 代表使用全部的硬體執行緒
+inline int resolve_thread_count(int threads) {
+    if (threads > 0) {
+        return threads;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// 在 thread_count 個執行緒上跑 fn(0) ... fn(count - 1), 每個執行緒做完一個就去拿下一個 index
+// 所有工作結束後才回傳, 如果有任何一個丟出例外, 會在呼叫端重新丟出第一個例外
+template <typename Fn>
+void parallel_for(int count, int thread_count, Fn &&fn) {
+    thread_count = std::min(resolve_thread_count(thread_count), count);
+    if (thread_count <= 1) {
+        for (int i = 0; i < count; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    std::atomic<int> next = 0;
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&] {
+        for (int i = next++; i < count; i = next++) {
+            try {
+                fn(i);
+            } catch (...) {
+                std::lock_guard lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next = count;
+            }
+        }
+    };
+    {
+        std::vector<std::jthread> threads;
+        threads.reserve(thread_count - 1);
+        for (int t = 1; t < thread_count; t++) {
+            threads.emplace_back(worker);
+        }
+        worker();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+}  // namespace f9ay
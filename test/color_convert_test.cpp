@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "color_convert.hpp"
+
+using namespace f9ay;
+
+template <colors::color_type ColorType>
+std::vector<ColorType> generateRandomRow(std::mt19937& rng, int n) {
+    std::uniform_int_distribution<int> dist(0, 255);
+    std::vector<ColorType> row(n);
+    for (auto& px : row) {
+        px.r = dist(rng);
+        px.g = dist(rng);
+        px.b = dist(rng);
+        if constexpr (requires { px.a; }) {
+            px.a = dist(rng);
+        }
+    }
+    return row;
+}
+
+template <colors::color_type ColorType, typename T>
+void checkRow(std::mt19937& rng, int n) {
+    const auto row = generateRandomRow<ColorType>(rng, n);
+    std::vector<T> y(n), cb(n), cr(n);
+    std::vector<T> y_scalar(n), cb_scalar(n), cr_scalar(n);
+    Ycbcr_convert::convert_row(row.data(), n, y.data(), cb.data(), cr.data());
+    Ycbcr_convert::convert_scalar(row.data(), n, y_scalar.data(), cb_scalar.data(), cr_scalar.data());
+
+    ASSERT_EQ(y, y_scalar);
+    ASSERT_EQ(cb, cb_scalar);
+    ASSERT_EQ(cr, cr_scalar);
+
+    for (int i = 0; i < n; i++) {
+        const float r = row[i].r;
+        const float g = row[i].g;
+        const float b = row[i].b;
+        // the floating point formula the encoder used before, clamped to 8 bit
+        const auto expect = [](float v) {
+            return std::clamp(std::round(v), 0.0f, 255.0f);
+        };
+        ASSERT_NEAR(y[i], expect(0.299f * r + 0.587f * g + 0.114f * b), 1) << "i: " << i;
+        ASSERT_NEAR(cb[i], expect(-0.168736f * r - 0.331364f * g + 0.5f * b + 128), 1) << "i: " << i;
+        ASSERT_NEAR(cr[i], expect(0.5f * r - 0.418688f * g - 0.081312f * b + 128), 1) << "i: " << i;
+    }
+}
+
+TEST(ColorConvertTest, MatchesFloatFormula) {
+    std::mt19937 rng(5);
+    // include widths that leave a scalar tail after the SIMD loop
+    for (int n : {1, 15, 16, 17, 33, 100, 257}) {
+        checkRow<colors::RGB, int16_t>(rng, n);
+        checkRow<colors::BGR, int16_t>(rng, n);
+        checkRow<colors::RGBA, int16_t>(rng, n);
+        checkRow<colors::BGRA, int16_t>(rng, n);
+        checkRow<colors::RGB, uint8_t>(rng, n);
+        checkRow<colors::BGR, uint8_t>(rng, n);
+        checkRow<colors::RGBA, uint8_t>(rng, n);
+        checkRow<colors::BGRA, uint8_t>(rng, n);
+    }
+}
+
+TEST(ColorConvertTest, PrimaryColors) {
+    const std::vector<colors::BGR> row = {{0, 0, 0}, {255, 255, 255}, {0, 0, 255}, {0, 255, 0}, {255, 0, 0}};
+    const int n = row.size();
+    std::vector<uint8_t> y(n), cb(n), cr(n);
+    Ycbcr_convert::convert_row(row.data(), n, y.data(), cb.data(), cr.data());
+
+    EXPECT_EQ(y, (std::vector<uint8_t>{0, 255, 76, 150, 29}));
+    EXPECT_EQ(cb, (std::vector<uint8_t>{128, 128, 85, 44, 255}));
+    EXPECT_EQ(cr, (std::vector<uint8_t>{128, 128, 255, 21, 107}));
+}
+
+template <int h, colors::color_type ColorType>
+void checkDownSampledRows(std::mt19937& rng, int n) {
+    const int padded_n = (n + 15) / 16 * 16;
+    std::vector<int16_t> y(padded_n), cb(padded_n / h), cr(padded_n / h);
+    std::vector<int16_t> cb_expect(padded_n / h), cr_expect(padded_n / h);
+    for (int row_index = 0; row_index < 2; row_index++) {
+        const auto row = generateRandomRow<ColorType>(rng, n);
+        Ycbcr_convert::convert_row_down_sampled<h>(row.data(), n, padded_n, y.data(), cb.data(), cr.data(),
+                                                   row_index > 0);
+
+        // full resolution conversion, right edge replicated, then summed
+        std::vector<int16_t> y_full(padded_n), cb_full(padded_n), cr_full(padded_n);
+        Ycbcr_convert::convert_scalar(row.data(), n, y_full.data(), cb_full.data(), cr_full.data());
+        for (int i = n; i < padded_n; i++) {
+            y_full[i] = y_full[n - 1];
+            cb_full[i] = cb_full[n - 1];
+            cr_full[i] = cr_full[n - 1];
+        }
+        ASSERT_EQ(y, y_full) << "n: " << n;
+        for (int i = 0; i < padded_n; i++) {
+            cb_expect[i / h] = (row_index > 0 || i % h > 0 ? cb_expect[i / h] : 0) + cb_full[i];
+            cr_expect[i / h] = (row_index > 0 || i % h > 0 ? cr_expect[i / h] : 0) + cr_full[i];
+        }
+        ASSERT_EQ(cb, cb_expect) << "n: " << n;
+        ASSERT_EQ(cr, cr_expect) << "n: " << n;
+    }
+}
+
+TEST(ColorConvertTest, DownSampledMatchesFullResolution) {
+    std::mt19937 rng(16);
+    for (int n : {1, 15, 16, 17, 33, 100, 257}) {
+        checkDownSampledRows<2, colors::BGR>(rng, n);
+        checkDownSampledRows<2, colors::RGBA>(rng, n);
+        checkDownSampledRows<1, colors::RGB>(rng, n);
+        checkDownSampledRows<1, colors::BGRA>(rng, n);
+    }
+}
+
+TEST(ColorConvertTest, InverseMatchesFloatFormula) {
+    std::mt19937 rng(12);
+    std::uniform_int_distribution<int> dist(0, 255);
+    for (int chroma_shift : {0, 1}) {
+        for (int n : {1, 15, 16, 17, 33, 100, 257}) {
+            const int chroma_n = (n + chroma_shift) >> chroma_shift;
+            std::vector<uint8_t> y(n), cb(chroma_n), cr(chroma_n);
+            for (auto& x : y) {
+                x = dist(rng);
+            }
+            for (int i = 0; i < chroma_n; i++) {
+                cb[i] = dist(rng);
+                cr[i] = dist(rng);
+            }
+            std::vector<colors::BGR> out(n);
+            Ycbcr_to_bgr::convert_row(y.data(), cb.data(), cr.data(), n, chroma_shift, out.data());
+
+            for (int i = 0; i < n; i++) {
+                const float luma = y[i];
+                const float cb_ = cb[i >> chroma_shift] - 128.0f;
+                const float cr_ = cr[i >> chroma_shift] - 128.0f;
+                const auto expect = [](float v) {
+                    return std::clamp(std::round(v), 0.0f, 255.0f);
+                };
+                ASSERT_NEAR(out[i].r, expect(luma + 1.402f * cr_), 1) << "n: " << n << ", i: " << i;
+                ASSERT_NEAR(out[i].g, expect(luma - 0.344136f * cb_ - 0.714136f * cr_), 1)
+                    << "n: " << n << ", i: " << i;
+                ASSERT_NEAR(out[i].b, expect(luma + 1.772f * cb_), 1) << "n: " << n << ", i: " << i;
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,188 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <random>
+
+#include "dct.hpp"
+
+using namespace f9ay;
+
+// Random level shifted 8x8 block, same range the JPEG encoder feeds the DCT
+std::array<int, 64> generateRandomBlock(std::mt19937& rng) {
+    std::uniform_int_distribution<int> dist(-128, 127);
+    std::array<int, 64> block;
+    for (auto& x : block) {
+        x = dist(rng);
+    }
+    return block;
+}
+
+Matrix<int> toMatrix(const std::array<int, 64>& block) {
+    return Matrix<int>(block.data(), 8, 8);
+}
+
+TEST(DctTest, AanMatchesReference) {
+    std::mt19937 rng(14);
+    const int TEST_ROUNDS = 200;
+
+    for (int round = 0; round < TEST_ROUNDS; round++) {
+        auto block = generateRandomBlock(rng);
+        auto expected = Dct_old<8>::dct<int, int>(toMatrix(block));
+
+        auto aan = block;
+        Dct_aan::dct_scalar(aan);
+
+        for (int u = 0; u < 8; u++) {
+            for (int v = 0; v < 8; v++) {
+                // undo the scale that is normally folded into the quantization table
+                const double descaled =
+                    aan[u * 8 + v] / (Dct_aan::scale[u] * Dct_aan::scale[v] * (1 << Dct_aan::output_bits));
+                // within JPEG rounding tolerance
+                ASSERT_NEAR(std::round(descaled), (expected[u, v]), 1)
+                    << "Round: " << round << ", u: " << u << ", v: " << v;
+            }
+        }
+    }
+}
+
+TEST(DctTest, FloatMatchesReference) {
+    std::mt19937 rng(94);
+    const int TEST_ROUNDS = 200;
+
+    for (int round = 0; round < TEST_ROUNDS; round++) {
+        auto block = generateRandomBlock(rng);
+        auto expected = Dct_old<8>::dct<int, int>(toMatrix(block));
+
+        auto result = block;
+        Dct<8>::dct(result);
+
+        for (int u = 0; u < 8; u++) {
+            for (int v = 0; v < 8; v++) {
+                ASSERT_NEAR(result[u * 8 + v], (expected[u, v]), 1)
+                    << "Round: " << round << ", u: " << u << ", v: " << v;
+            }
+        }
+    }
+}
+
+TEST(DctTest, IdctMatchesReference) {
+    std::mt19937 rng(27);
+    std::uniform_int_distribution<int> dist(-512, 512);
+    const int TEST_ROUNDS = 200;
+
+    for (int round = 0; round < TEST_ROUNDS; round++) {
+        // 解碼時反量化後的係數大多是 0
+        Idct_int::block_t block{};
+        for (int i = 0; i < 1 + round % 16; i++) {
+            block[rng() % 64] = dist(rng);
+        }
+        std::array<uint8_t, 64> out;
+        Idct_int::idct(block, out.data(), 8);
+
+        for (int x = 0; x < 8; x++) {
+            for (int y = 0; y < 8; y++) {
+                double sum = 0;
+                for (int u = 0; u < 8; u++) {
+                    for (int v = 0; v < 8; v++) {
+                        const double cu = u == 0 ? std::sqrt(0.5) : 1.0;
+                        const double cv = v == 0 ? std::sqrt(0.5) : 1.0;
+                        sum += cu * cv * block[u * 8 + v] * std::cos((2 * x + 1) * u * M_PI / 16) *
+                               std::cos((2 * y + 1) * v * M_PI / 16);
+                    }
+                }
+                const double expected = std::clamp(std::round(sum / 4 + 128), 0.0, 255.0);
+                ASSERT_NEAR(out[x * 8 + y], expected, 1) << "Round: " << round << ", x: " << x << ", y: " << y;
+            }
+        }
+    }
+}
+
+TEST(DctTest, ReducedIdctMatchesReference) {
+    std::mt19937 rng(31);
+    std::uniform_int_distribution<int> dist(-512, 512);
+    const int TEST_ROUNDS = 200;
+
+    for (int round = 0; round < TEST_ROUNDS; round++) {
+        Idct_int::block_t block;
+        for (auto& x : block) {
+            x = dist(rng);
+        }
+        for (int size : {4, 2}) {
+            std::array<uint8_t, 64> out;
+            if (size == 4) {
+                Idct_int::idct_4x4(block, out.data(), 8);
+            } else {
+                Idct_int::idct_2x2(block, out.data(), 8);
+            }
+            // 只用左上 size x size 的係數, 正規化跟 8x8 一樣
+            for (int x = 0; x < size; x++) {
+                for (int y = 0; y < size; y++) {
+                    double sum = 0;
+                    for (int u = 0; u < size; u++) {
+                        for (int v = 0; v < size; v++) {
+                            const double cu = u == 0 ? std::sqrt(0.5) : 1.0;
+                            const double cv = v == 0 ? std::sqrt(0.5) : 1.0;
+                            sum += cu * cv * block[u * 8 + v] * std::cos((2 * x + 1) * u * M_PI / (2 * size)) *
+                                   std::cos((2 * y + 1) * v * M_PI / (2 * size));
+                        }
+                    }
+                    const double expected = std::clamp(std::round(sum / 4 + 128), 0.0, 255.0);
+                    ASSERT_NEAR(out[x * 8 + y], expected, 1)
+                        << "Round: " << round << ", size: " << size << ", x: " << x << ", y: " << y;
+                }
+            }
+        }
+    }
+}
+
+TEST(DctTest, IdctDcMatchesFull) {
+    for (int dc = -1100; dc <= 1100; dc += 7) {
+        Idct_int::block_t block{};
+        block[0] = dc;
+        std::array<uint8_t, 64> full;
+        std::array<uint8_t, 64> dc_only;
+        Idct_int::idct_scalar(block, full.data(), 8);
+        Idct_int::idct_dc(dc, dc_only.data(), 8);
+        ASSERT_EQ(full, dc_only) << "DC: " << dc;
+    }
+}
+
+#ifdef __AVX2__
+TEST(DctTest, IdctSimdMatchesScalar) {
+    std::mt19937 rng(4);
+    std::uniform_int_distribution<int> dist(-2048, 2047);
+    const int TEST_ROUNDS = 200;
+
+    for (int round = 0; round < TEST_ROUNDS; round++) {
+        Idct_int::block_t block;
+        for (auto& x : block) {
+            x = dist(rng);
+        }
+        std::array<uint8_t, 64> scalar;
+        std::array<uint8_t, 64> simd;
+        Idct_int::idct_scalar(block, scalar.data(), 8);
+        Idct_int::idct_avx2(block, simd.data(), 8);
+        ASSERT_EQ(scalar, simd) << "Round: " << round;
+    }
+}
+
+TEST(DctTest, AanSimdMatchesScalar) {
+    std::mt19937 rng(1);
+    const int TEST_ROUNDS = 200;
+
+    for (int round = 0; round < TEST_ROUNDS; round++) {
+        auto scalar = generateRandomBlock(rng);
+        auto simd = scalar;
+        Dct_aan::dct_scalar(scalar);
+        Dct_aan::dct_avx2(simd);
+        ASSERT_EQ(scalar, simd) << "Round: " << round;
+    }
+}
+#endif
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
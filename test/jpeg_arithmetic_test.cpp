@@ -0,0 +1,115 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <span>
+
+#include "jpeg.hpp"
+#include "jpeg_encoder.hpp"
+
+using namespace f9ay;
+
+namespace {
+// 漸層加上一些雜訊般的紋理, 寬高都不是 MCU 的倍數
+Matrix<colors::BGR> makeImage(int height, int width) {
+    Matrix<colors::BGR> image(height, width);
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            const auto noise = static_cast<uint8_t>((i * 37 + j * 91 + i * j) % 23);
+            image[i, j] = {static_cast<uint8_t>(j * 200 / width + noise), static_cast<uint8_t>(i * 200 / height),
+                           static_cast<uint8_t>((i / 4 + j / 6) % 2 == 0 ? 60 + noise : 180)};
+        }
+    }
+    return image;
+}
+
+template <Jpeg_sampling sampling>
+void expectSameCoefficients(const Matrix<colors::BGR>& image, Jpeg_options options) {
+    options.entropy = Jpeg_entropy::arithmetic;
+    const auto arithmetic = Jpeg<sampling>::write(image, options);
+    options.entropy = Jpeg_entropy::huffman;
+    const auto huffman = Jpeg<sampling>::write(image, options);
+    const std::array sof9{std::byte{0xFF}, std::byte{0xC9}};
+    EXPECT_FALSE(std::ranges::search(std::span(arithmetic.first.get(), arithmetic.second), sof9).empty());
+
+    const auto expected = Jpeg_decoder::read_coefficients(huffman.first.get(), huffman.second);
+    const auto actual = Jpeg_decoder::read_coefficients(arithmetic.first.get(), arithmetic.second);
+    ASSERT_EQ(actual.components.size(), expected.components.size());
+    for (std::size_t c = 0; c < actual.components.size(); c++) {
+        EXPECT_EQ(actual.components[c].blocks, expected.components[c].blocks) << "component: " << c;
+    }
+}
+}  // namespace
+
+TEST(JpegArithmeticTest, KeepsCoefficientsOfHuffmanPath) {
+    const auto image = makeImage(61, 83);
+    for (const auto& options :
+         {Jpeg_options{}, Jpeg_options{.dct = Jpeg_dct::aan_integer, .quality = 30},
+          Jpeg_options{.quality = 95, .restart_rows = 1}, Jpeg_options{.restart_rows = 2, .threads = 3},
+          Jpeg_options{.threads = 4}}) {
+        expectSameCoefficients<Jpeg_sampling::ds_4_2_0>(image, options);
+        expectSameCoefficients<Jpeg_sampling::ds_4_4_4>(image, options);
+        expectSameCoefficients<Jpeg_sampling::ds_4_2_2>(image, options);
+        expectSameCoefficients<Jpeg_sampling::grayscale>(image, options);
+    }
+}
+
+TEST(JpegArithmeticTest, DecodesToSamePixels) {
+    const auto image = makeImage(45, 70);
+    const auto arithmetic = Jpeg<>::write(image, {.entropy = Jpeg_entropy::arithmetic, .restart_rows = 1});
+    const auto huffman = Jpeg<>::write(image, {.restart_rows = 1});
+    const auto expected = Jpeg_decoder::decode(huffman.first.get(), huffman.second);
+    const auto actual =
+        std::get<Matrix<colors::BGR>>(Jpeg<>::importFromByte(arithmetic.first.get(), arithmetic.second));
+    ASSERT_EQ(actual.row(), expected.row());
+    ASSERT_EQ(actual.col(), expected.col());
+    for (int i = 0; i < actual.row(); i++) {
+        for (int j = 0; j < actual.col(); j++) {
+            const auto& p = actual[i, j];
+            const auto& q = expected[i, j];
+            ASSERT_TRUE(p.b == q.b && p.g == q.g && p.r == q.r) << "i: " << i << ", j: " << j;
+        }
+    }
+}
+
+TEST(JpegArithmeticTest, SmallerThanOptimizedHuffman) {
+    const auto image = makeImage(240, 320);
+    for (const int quality : {50, 90}) {
+        const auto arithmetic = Jpeg<>::write(image, {.entropy = Jpeg_entropy::arithmetic, .quality = quality});
+        const auto huffman = Jpeg<>::write(image, {.quality = quality});
+        EXPECT_LT(arithmetic.second, huffman.second) << "quality: " << quality;
+    }
+}
+
+TEST(JpegArithmeticTest, AllWritePathsAgree) {
+    const auto image = makeImage(70, 90);
+    for (const auto& options : {Jpeg_options{.entropy = Jpeg_entropy::arithmetic},
+                                Jpeg_options{.entropy = Jpeg_entropy::arithmetic, .restart_rows = 2}}) {
+        const auto written = Jpeg<>::write(image, options);
+        const std::span expected(written.first.get(), written.second);
+
+        Jpeg_encoder<> encoder;
+        const auto encoded = encoder.encode(image, options);
+        EXPECT_TRUE(std::ranges::equal(encoded, expected));
+
+        auto parallel = options;
+        parallel.threads = 3;
+        const auto threaded = Jpeg<>::write(image, parallel);
+        EXPECT_TRUE(std::ranges::equal(std::span(threaded.first.get(), threaded.second), expected));
+    }
+    const auto streamed = Jpeg<>::write_streaming(image, {.entropy = Jpeg_entropy::arithmetic});
+    const auto written = Jpeg<>::write(image, {.entropy = Jpeg_entropy::arithmetic});
+    EXPECT_TRUE(std::ranges::equal(std::span(streamed.first.get(), streamed.second),
+                                   std::span(written.first.get(), written.second)));
+}
+
+TEST(JpegArithmeticTest, RejectsProgressive) {
+    EXPECT_THROW(Jpeg<>::write(makeImage(16, 16),
+                               {.entropy = Jpeg_entropy::arithmetic, .scans = Jpeg_scan::default_script()}),
+                 std::invalid_argument);
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
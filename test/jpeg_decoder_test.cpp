@@ -0,0 +1,218 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "jpeg.hpp"
+
+using namespace f9ay;
+
+namespace {
+// 平滑的漸層加上一些斜線, 寬高都不是 MCU 的倍數
+Matrix<colors::BGR> makeImage(int height, int width) {
+    Matrix<colors::BGR> image(height, width);
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            const auto stripe = static_cast<uint8_t>((i + j) % 32 < 16 ? 40 : 0);
+            image[i, j] = {static_cast<uint8_t>(j * 255 / width), static_cast<uint8_t>(i * 255 / height),
+                           static_cast<uint8_t>(200 - stripe)};
+        }
+    }
+    return image;
+}
+
+double psnr(const Matrix<colors::BGR>& a, const Matrix<colors::BGR>& b) {
+    double mse = 0;
+    for (int i = 0; i < a.row(); i++) {
+        for (int j = 0; j < a.col(); j++) {
+            const auto& p = a[i, j];
+            const auto& q = b[i, j];
+            mse += (p.b - q.b) * (p.b - q.b) + (p.g - q.g) * (p.g - q.g) + (p.r - q.r) * (p.r - q.r);
+        }
+    }
+    mse /= a.row() * a.col() * 3.0;
+    return mse == 0 ? 99 : 10 * std::log10(255.0 * 255.0 / mse);
+}
+
+template <Jpeg_sampling sampling>
+Matrix<colors::BGR> roundTrip(const Matrix<colors::BGR>& image, const Jpeg_options& options) {
+    const auto [bytes, size] = Jpeg<sampling>::write(image, options);
+    auto decoded = Jpeg<sampling>::importFromByte(bytes.get(), size);
+    return std::get<Matrix<colors::BGR>>(std::move(decoded));
+}
+}  // namespace
+
+TEST(JpegDecoderTest, BitReaderRemovesStuffing) {
+    const std::vector<std::byte> data = {std::byte{0xFF}, std::byte{0x00}, std::byte{0xA5}, std::byte{0xFF},
+                                         std::byte{0xD9}};
+    Jpeg_bit_reader reader(data.data(), data.data() + data.size());
+    EXPECT_EQ(reader.peek(16), 0xFFA5u);
+    reader.skip(12);
+    // 0101 的最高位是 0, 代表負數 5 - 15
+    EXPECT_EQ(reader.receive_extend(4), -10);
+    // 碰到 marker 之後只會讀到 0
+    EXPECT_EQ(reader.peek(8), 0u);
+    EXPECT_EQ(reader.next_marker(), data.data() + 3);
+}
+
+TEST(JpegDecoderTest, HuffmanDecodesStandardTables) {
+    const auto& tables = Jpeg_huffman_tables::standard();
+    for (const auto* table : {&tables.y_dc, &tables.y_ac, &tables.uv_dc, &tables.uv_ac}) {
+        std::vector<std::byte> out;
+        Jpeg_bit_writer writer(out);
+        for (const auto symbol : table->symbols()) {
+            const auto code = table->getMapping(symbol);
+            writer.write(code.value, code.length);
+        }
+        writer.flush();
+
+        const Jpeg_huffman_decoder decoder(*table);
+        Jpeg_bit_reader reader(out.data(), out.data() + out.size());
+        for (const auto symbol : table->symbols()) {
+            ASSERT_EQ(decoder.decode(reader), symbol);
+        }
+    }
+}
+
+TEST(JpegDecoderTest, RoundTrip444) {
+    const auto image = makeImage(45, 61);
+    const auto decoded = roundTrip<Jpeg_sampling::ds_4_4_4>(image, {.quality = 90});
+    ASSERT_EQ(decoded.row(), image.row());
+    ASSERT_EQ(decoded.col(), image.col());
+    EXPECT_GT(psnr(image, decoded), 35);
+}
+
+TEST(JpegDecoderTest, RoundTrip420) {
+    const auto image = makeImage(45, 61);
+    const auto decoded = roundTrip<Jpeg_sampling::ds_4_2_0>(image, {.quality = 90});
+    ASSERT_EQ(decoded.row(), image.row());
+    ASSERT_EQ(decoded.col(), image.col());
+    EXPECT_GT(psnr(image, decoded), 30);
+}
+
+TEST(JpegDecoderTest, RoundTrip422And440) {
+    const auto image = makeImage(45, 61);
+    const auto h2v1 = roundTrip<Jpeg_sampling::ds_4_2_2>(image, {.quality = 90});
+    const auto h1v2 = roundTrip<Jpeg_sampling::ds_4_4_0>(image, {.quality = 90});
+    ASSERT_EQ(h2v1.row(), image.row());
+    ASSERT_EQ(h2v1.col(), image.col());
+    ASSERT_EQ(h1v2.row(), image.row());
+    ASSERT_EQ(h1v2.col(), image.col());
+    EXPECT_GT(psnr(image, h2v1), 30);
+    EXPECT_GT(psnr(image, h1v2), 30);
+}
+
+TEST(JpegDecoderTest, RoundTripGrayscale) {
+    const auto image = makeImage(45, 61);
+    for (const auto &options : {Jpeg_options{.quality = 90}, Jpeg_options{.quality = 90, .restart_rows = 2},
+                                Jpeg_options{.huffman = Jpeg_huffman::standard, .quality = 90}}) {
+        const auto decoded = roundTrip<Jpeg_sampling::grayscale>(image, options);
+        ASSERT_EQ(decoded.row(), image.row());
+        ASSERT_EQ(decoded.col(), image.col());
+        // 解出來的三個 channel 都是 Y
+        Matrix<colors::BGR> luma(image.row(), image.col());
+        for (int i = 0; i < image.row(); i++) {
+            for (int j = 0; j < image.col(); j++) {
+                const auto &p = image[i, j];
+                const auto y = static_cast<uint8_t>(std::lround(0.299 * p.r + 0.587 * p.g + 0.114 * p.b));
+                luma[i, j] = {y, y, y};
+                const auto &q = decoded[i, j];
+                ASSERT_TRUE(q.b == q.g && q.r == q.g) << "i: " << i << ", j: " << j;
+            }
+        }
+        EXPECT_GT(psnr(luma, decoded), 35);
+    }
+
+    // 只有一個 component, 比彩色的小
+    const auto gray = Jpeg<Jpeg_sampling::grayscale>::write(image);
+    const auto color = Jpeg<Jpeg_sampling::ds_4_2_0>::write(image);
+    EXPECT_LT(gray.second, color.second);
+}
+
+TEST(JpegDecoderTest, RestartIntervalMatchesPlainStream) {
+    const auto image = makeImage(70, 33);
+    const auto plain = roundTrip<Jpeg_sampling::ds_4_2_0>(image, {.quality = 75});
+    const auto restart = roundTrip<Jpeg_sampling::ds_4_2_0>(image, {.quality = 75, .restart_rows = 1});
+    // 係數一樣, 解出來也要一樣
+    EXPECT_EQ(psnr(plain, restart), 99);
+}
+
+TEST(JpegDecoderTest, ScaledDecodeMatchesDownscaledImage) {
+    const auto image = makeImage(64, 48);
+    const auto [bytes, size] = Jpeg<Jpeg_sampling::ds_4_4_4>::write(image, {.quality = 90});
+    const auto full = std::get<Matrix<colors::BGR>>(Jpeg<Jpeg_sampling::ds_4_4_4>::importFromByte(bytes.get(), size));
+
+    for (int scale : {2, 4, 8}) {
+        const auto scaled = std::get<Matrix<colors::BGR>>(
+            Jpeg<Jpeg_sampling::ds_4_4_4>::importFromByte(bytes.get(), size, {.scale = scale}));
+        ASSERT_EQ(scaled.row(), 64 / scale);
+        ASSERT_EQ(scaled.col(), 48 / scale);
+
+        // 跟原圖解出來後每 scale x scale 取平均比較
+        Matrix<colors::BGR> average(64 / scale, 48 / scale);
+        for (int i = 0; i < average.row(); i++) {
+            for (int j = 0; j < average.col(); j++) {
+                int b = 0, g = 0, r = 0;
+                for (int y = i * scale; y < (i + 1) * scale; y++) {
+                    for (int x = j * scale; x < (j + 1) * scale; x++) {
+                        b += full[y, x].b;
+                        g += full[y, x].g;
+                        r += full[y, x].r;
+                    }
+                }
+                const int n = scale * scale;
+                average[i, j] = {static_cast<uint8_t>((b + n / 2) / n), static_cast<uint8_t>((g + n / 2) / n),
+                                 static_cast<uint8_t>((r + n / 2) / n)};
+            }
+        }
+        EXPECT_GT(psnr(average, scaled), scale == 8 ? 45 : 30) << "scale: " << scale;
+    }
+
+    // 大小不是 scale 的倍數時無條件進位
+    const auto [odd_bytes, odd_size] = Jpeg<Jpeg_sampling::ds_4_2_0>::write(makeImage(45, 61));
+    const auto odd = std::get<Matrix<colors::BGR>>(
+        Jpeg<Jpeg_sampling::ds_4_2_0>::importFromByte(odd_bytes.get(), odd_size, {.scale = 8}));
+    EXPECT_EQ(odd.row(), 6);
+    EXPECT_EQ(odd.col(), 8);
+    EXPECT_THROW(Jpeg<Jpeg_sampling::ds_4_2_0>::importFromByte(odd_bytes.get(), odd_size, {.scale = 3}),
+                 std::invalid_argument);
+}
+
+TEST(JpegDecoderTest, RejectsProgressive) {
+    const auto image = makeImage(16, 16);
+    const auto [bytes, size] =
+        Jpeg<Jpeg_sampling::ds_4_4_4>::write(image, {.scans = Jpeg_scan::default_script()});
+    EXPECT_THROW(Jpeg<Jpeg_sampling::ds_4_4_4>::importFromByte(bytes.get(), size), std::runtime_error);
+}
+
+TEST(JpegDecoderTest, RejectsTruncatedData) {
+    const auto image = makeImage(16, 16);
+    const auto [bytes, size] = Jpeg<Jpeg_sampling::ds_4_4_4>::write(image);
+    EXPECT_THROW(Jpeg<Jpeg_sampling::ds_4_4_4>::importFromByte(bytes.get(), size / 2), std::runtime_error);
+}
+
+TEST(JpegDecoderTest, RejectsBadScanParameters) {
+    const auto image = makeImage(16, 16);
+    const auto [bytes, size] = Jpeg<Jpeg_sampling::ds_4_4_4>::write(image);
+    const std::span data(bytes.get(), size);
+    const std::array sos{std::byte{0xFF}, std::byte{0xDA}};
+    // SOS: marker, 長度, 元件數, 每個元件 2 bytes, 接著是 Ss, Se, Ah/Al
+    const auto marker = std::ranges::search(data, sos).begin();
+    ASSERT_NE(marker, data.end());
+    const auto parameters = marker + 5 + 2 * std::to_integer<int>(marker[4]);
+    for (const auto& [offset, value] : {std::pair{0, 1}, std::pair{1, 62}, std::pair{2, 0x10}, std::pair{2, 0x01}}) {
+        std::vector<std::byte> patched(data.begin(), data.end());
+        patched[parameters - data.begin() + offset] = std::byte(value);
+        EXPECT_THROW(Jpeg<Jpeg_sampling::ds_4_4_4>::importFromByte(patched.data(), patched.size()), std::runtime_error)
+            << "offset: " << offset << ", value: " << value;
+    }
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <variant>
+
+#include "bmp.hpp"
+#include "jpeg.hpp"
+
+using namespace f9ay;
+
+// F9AY_TEST_DATA_DIR is defined by CMake and points at test_data/
+
+namespace {
+// FNV-1a, 64 bit
+uint64_t hashBytes(const std::pair<std::unique_ptr<std::byte[]>, size_t>& bytes) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < bytes.second; i++) {
+        hash = (hash ^ static_cast<uint8_t>(bytes.first[i])) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+Midway readBmp(const std::string& name) {
+    std::ifstream fs(std::string(F9AY_TEST_DATA_DIR) + "/" + name, std::ios::binary);
+    const auto file = readFile(fs);
+    return Bmp::importFromByte(file.get());
+}
+
+template <Jpeg_sampling sampling>
+uint64_t encodeHash(const Midway& image, const Jpeg_options& options) {
+    return std::visit(
+        [&](const auto& matrix) {
+            return hashBytes(Jpeg<sampling>::write(matrix, options));
+        },
+        image);
+}
+
+struct Golden {
+    const char* file;
+    uint64_t hash_420;
+    uint64_t hash_444;
+};
+}  // namespace
+
+// The integer pipeline (fixed-point colour conversion, Dct_aan, integer quantization) must give the same bytes on
+// every compiler, optimisation level and with or without AVX2. If a change here is intended, regenerate the hashes
+// and say why in the commit.
+TEST(JpegDeterminismTest, IntegerPipelineMatchesGoldenHashes) {
+    constexpr Golden golden[] = {
+        {"box.bmp", 0x8E91F23A0F92733Full, 0x889A9B5F910902ADull},
+        {"test.bmp", 0x338D849BAB6E298Eull, 0xF5CFB5BF8280953Dull},
+        {"test2.bmp", 0x96E0DCEC1AE54CB2ull, 0x9A62250EC1C4247Dull},
+        {"all_wh.bmp", 0xDF20F64F626FB1D3ull, 0xB49B0E2A9943D472ull},
+        {"red_pixel.bmp", 0xB4C6858920AD0C8Dull, 0x219B57D4BA80754Dull},
+    };
+    const Jpeg_options options{.dct = Jpeg_dct::aan_integer, .quality = 80};
+    for (const auto& [file, hash_420, hash_444] : golden) {
+        const auto image = readBmp(file);
+        EXPECT_EQ(encodeHash<Jpeg_sampling::ds_4_2_0>(image, options), hash_420) << file;
+        EXPECT_EQ(encodeHash<Jpeg_sampling::ds_4_4_4>(image, options), hash_444) << file;
+    }
+}
+
+TEST(JpegDeterminismTest, IntegerPipelineMatchesGoldenHashesWithRestarts) {
+    // standard tables and parallel restart intervals go through different code paths
+    const auto image = readBmp("test.bmp");
+    EXPECT_EQ(encodeHash<Jpeg_sampling::ds_4_2_0>(image, {.dct = Jpeg_dct::aan_integer,
+                                                         .huffman = Jpeg_huffman::standard,
+                                                         .restart_rows = 2,
+                                                         .threads = 3}),
+              0x5B1ED0C94EE46F67ull);
+}
+
+TEST(JpegDeterminismTest, IntegerPipelineMatchesGoldenHashesWithProgressiveScans) {
+    // 每個 scan 的 huffman 表也是從固定大小的頻率陣列建的
+    const auto image = readBmp("test.bmp");
+    const Jpeg_options options{.dct = Jpeg_dct::aan_integer, .scans = Jpeg_scan::default_script()};
+    EXPECT_EQ(encodeHash<Jpeg_sampling::ds_4_2_0>(image, options), 0x79B5CE3E99C90F8Dull);
+    EXPECT_EQ(encodeHash<Jpeg_sampling::ds_4_4_4>(image, options), 0x56A067ACA0DAC187ull);
+}
+
+TEST(JpegDeterminismTest, IntegerPipelineMatchesGoldenHashWithArithmeticCoding) {
+    // 熵編碼的部分跟 libjpeg-turbo 用同樣係數編出來的 SOF9 完全一樣
+    const auto image = readBmp("test.bmp");
+    EXPECT_EQ(encodeHash<Jpeg_sampling::ds_4_4_4>(
+                  image, {.dct = Jpeg_dct::aan_integer, .entropy = Jpeg_entropy::arithmetic, .restart_rows = 3}),
+              0x6252F08738E893A8ull);
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
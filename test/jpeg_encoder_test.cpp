@@ -0,0 +1,325 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "jpeg_encoder.hpp"
+
+using namespace f9ay;
+
+namespace {
+// 只計算目前執行緒在 counting 打開時的配置次數
+thread_local bool counting = false;
+thread_local int allocations = 0;
+}  // namespace
+
+void* operator new(std::size_t size) {
+    if (counting) {
+        allocations++;
+    }
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+Matrix<colors::BGR> makeImage(int height, int width, int seed = 0) {
+    Matrix<colors::BGR> image(height, width);
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            const auto stripe = static_cast<uint8_t>((i + j + seed) % 32 < 16 ? 40 : 0);
+            image[i, j] = {static_cast<uint8_t>(j * 255 / width), static_cast<uint8_t>((i * 255 / height) ^ seed),
+                           static_cast<uint8_t>(200 - stripe)};
+        }
+    }
+    return image;
+}
+
+std::vector<std::byte> toVector(std::span<const std::byte> bytes) {
+    return {bytes.begin(), bytes.end()};
+}
+
+std::vector<std::byte> toVector(const std::pair<std::unique_ptr<std::byte[]>, size_t>& bytes) {
+    return {bytes.first.get(), bytes.first.get() + bytes.second};
+}
+
+Matrix<colors::BGR> decode(const std::vector<std::byte>& bytes) {
+    return std::get<Matrix<colors::BGR>>(Jpeg<>::importFromByte(bytes.data(), bytes.size()));
+}
+
+bool samePixels(const Matrix<colors::BGR>& a, const Matrix<colors::BGR>& b) {
+    if (a.row() != b.row() || a.col() != b.col()) {
+        return false;
+    }
+    for (int i = 0; i < a.row(); i++) {
+        for (int j = 0; j < a.col(); j++) {
+            if (a[i, j].b != b[i, j].b || a[i, j].g != b[i, j].g || a[i, j].r != b[i, j].r) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+}  // namespace
+
+TEST(JpegEncoderTest, StandardTablesMatchStaticWriter) {
+    const auto image = makeImage(45, 61);
+    Jpeg_encoder<Jpeg_sampling::ds_4_2_0> encoder420;
+    Jpeg_encoder<Jpeg_sampling::ds_4_4_4> encoder444;
+    for (const auto& options : {Jpeg_options{.huffman = Jpeg_huffman::standard},
+                                Jpeg_options{.huffman = Jpeg_huffman::standard, .restart_rows = 2}}) {
+        EXPECT_EQ(toVector(encoder420.encode(image, options)),
+                  toVector(Jpeg<Jpeg_sampling::ds_4_2_0>::write(image, options)));
+        EXPECT_EQ(toVector(encoder444.encode(image, options)),
+                  toVector(Jpeg<Jpeg_sampling::ds_4_4_4>::write(image, options)));
+    }
+}
+
+TEST(JpegEncoderTest, OptimizedTablesKeepCoefficients) {
+    const auto image = makeImage(70, 33);
+    Jpeg_encoder<> encoder;
+    for (const auto& options : {Jpeg_options{}, Jpeg_options{.quality = 50, .restart_rows = 1}}) {
+        const auto bytes = toVector(encoder.encode(image, options));
+        const auto expected = toVector(Jpeg<>::write(image, options));
+        // 表不一樣, 但係數一樣, 解出來完全相同
+        EXPECT_TRUE(samePixels(decode(bytes), decode(expected)));
+        EXPECT_LE(bytes.size(), expected.size() + expected.size() / 100);
+    }
+}
+
+TEST(JpegEncoderTest, SampledTablesKeepCoefficients) {
+    // large enough that the bigger DHT segment does not dominate the file size
+    const auto image = makeImage(240, 320, 7);
+    const auto optimized = toVector(Jpeg<>::write(image));
+    const auto reference = decode(optimized);
+    const Jpeg_options sampled{.huffman = Jpeg_huffman::sampled, .huffman_sample_rows = 3};
+    Jpeg_encoder<> encoder;
+    for (const auto& bytes : {toVector(Jpeg<>::write(image, sampled)),
+                              toVector(Jpeg<>::write_streaming(image, sampled)),
+                              toVector(encoder.encode(image, sampled))}) {
+        EXPECT_TRUE(samePixels(decode(bytes), reference));
+        EXPECT_LE(bytes.size(), optimized.size() + optimized.size() / 10);
+    }
+
+    // restart intervals use the same sampled tables
+    auto restart = sampled;
+    restart.restart_rows = 2;
+    restart.threads = 3;
+    const auto restart_bytes = toVector(Jpeg<>::write(image, restart));
+    EXPECT_TRUE(samePixels(decode(restart_bytes), reference));
+    EXPECT_EQ(toVector(encoder.encode(image, restart)), restart_bytes);
+}
+
+TEST(JpegEncoderTest, NoAllocationsAfterFirstEncode) {
+    const auto large = makeImage(96, 80);
+    const auto small = makeImage(40, 72, 3);
+    Jpeg_encoder<> encoder;
+    encoder.encode(large);
+    encoder.encode(large, {.restart_rows = 1});
+
+    counting = true;
+    allocations = 0;
+    const auto size = encoder.encode(large).size();
+    encoder.encode(small);
+    encoder.encode(small, {.huffman = Jpeg_huffman::standard, .quality = 75});
+    encoder.encode(large, {.restart_rows = 2});
+    encoder.encode(small, {.huffman = Jpeg_huffman::sampled});
+    counting = false;
+
+    EXPECT_EQ(allocations, 0);
+    EXPECT_GT(size, 0u);
+}
+
+TEST(JpegEncoderTest, InstancesRunConcurrently) {
+    std::vector<Matrix<colors::BGR>> images;
+    std::vector<std::vector<std::byte>> expected;
+    Jpeg_encoder<> reference;
+    for (int seed = 0; seed < 8; seed++) {
+        images.push_back(makeImage(37 + seed * 5, 50 - seed * 3, seed));
+        expected.push_back(toVector(reference.encode(images.back(), {.quality = 30 + seed * 8})));
+    }
+
+    std::vector<std::vector<std::vector<std::byte>>> results(4);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t] {
+            Jpeg_encoder<> encoder;
+            for (int round = 0; round < 5; round++) {
+                for (int seed = 0; seed < 8; seed++) {
+                    results[t].push_back(toVector(encoder.encode(images[seed], {.quality = 30 + seed * 8})));
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (int t = 0; t < 4; t++) {
+        for (std::size_t k = 0; k < results[t].size(); k++) {
+            ASSERT_EQ(results[t][k], expected[k % 8]) << "thread: " << t << ", k: " << k;
+        }
+    }
+}
+
+TEST(JpegEncoderTest, RunLengthMatchesReference) {
+    // T.81 F.1.2.2 written out directly
+    auto reference = [](const std::array<int, 64>& block) {
+        std::vector<std::pair<uint8_t, int>> tokens;
+        int run = 0;
+        for (int i = 1; i < 64; i++) {
+            if (block[i] == 0) {
+                run++;
+                continue;
+            }
+            for (; run >= 16; run -= 16) {
+                tokens.emplace_back(0xF0, 0);
+            }
+            const int magnitude = std::abs(block[i]);
+            int size = 0;
+            while ((1 << size) <= magnitude) {
+                size++;
+            }
+            tokens.emplace_back(run << 4 | size, block[i] > 0 ? block[i] : block[i] + (1 << size) - 1);
+            run = 0;
+        }
+        if (run > 0) {
+            tokens.emplace_back(0x00, 0);
+        }
+        return tokens;
+    };
+
+    std::mt19937 rng(18);
+    std::uniform_int_distribution<int> value(-2047, 2047);
+    for (int round = 0; round < 2000; round++) {
+        std::array<int, 64> block{};
+        // from fully dense to only a few coefficients, including long zero runs and all-zero AC
+        const int density = round % 8;
+        for (int i = 0; i < 64; i++) {
+            if (density > 0 && static_cast<int>(rng() % 64) < 64 >> (density * 2 - 2)) {
+                block[i] = value(rng);
+            }
+        }
+        if (round % 5 == 0) {
+            block[63] = value(rng) | 1;
+        }
+        Jpeg<>::Rle_tokens tokens;
+        const int count = Jpeg<>::run_length_encode(block, tokens);
+        const auto expected = reference(block);
+        ASSERT_EQ(std::vector(tokens.begin(), tokens.begin() + count), expected) << "round: " << round;
+    }
+}
+
+TEST(JpegEncoderTest, ParallelWriteMatchesSerial) {
+    // 70 rows is 9 or 5 MCU rows, so some chunks get more rows than others
+    const auto image = makeImage(70, 93, 5);
+    auto check = [&]<Jpeg_sampling sampling>() {
+        for (const auto huffman : {Jpeg_huffman::optimized, Jpeg_huffman::standard, Jpeg_huffman::sampled}) {
+            const auto serial = toVector(Jpeg<sampling>::write(image, {.huffman = huffman, .quality = 85}));
+            for (const int threads : {2, 3, 0}) {
+                EXPECT_EQ(
+                    toVector(Jpeg<sampling>::write(image, {.huffman = huffman, .quality = 85, .threads = threads})),
+                    serial)
+                    << "sampling: " << static_cast<int>(sampling) << ", huffman: " << static_cast<int>(huffman)
+                    << ", threads: " << threads;
+            }
+        }
+    };
+    check.operator()<Jpeg_sampling::ds_4_4_4>();
+    check.operator()<Jpeg_sampling::ds_4_2_0>();
+    check.operator()<Jpeg_sampling::ds_4_2_2>();
+    check.operator()<Jpeg_sampling::grayscale>();
+}
+
+TEST(JpegEncoderTest, YuvInputMatchesRgbInput) {
+    constexpr int height = 45, width = 61, stride = 64;
+    const auto image = makeImage(height, width, 2);
+    // full resolution planes from the same converter write() uses, with padded rows
+    std::vector<uint8_t> y(height * stride), u(height * stride), v(height * stride);
+    for (int i = 0; i < height; i++) {
+        std::vector<int16_t> y_row(width), u_row(width), v_row(width);
+        Ycbcr_convert::convert_row(&image[i, 0], width, y_row.data(), u_row.data(), v_row.data());
+        std::copy(y_row.begin(), y_row.end(), &y[i * stride]);
+        std::copy(u_row.begin(), u_row.end(), &u[i * stride]);
+        std::copy(v_row.begin(), v_row.end(), &v[i * stride]);
+    }
+    // 2x2 averages, replicating the last row and column like the encoder does
+    constexpr int chroma_height = (height + 1) / 2, chroma_width = (width + 1) / 2;
+    std::vector<uint8_t> u420(chroma_height * chroma_width), v420(u420.size()), uv(u420.size() * 2);
+    for (int i = 0; i < chroma_height; i++) {
+        for (int j = 0; j < chroma_width; j++) {
+            int u_sum = 0, v_sum = 0;
+            for (int k = 0; k < 4; k++) {
+                const int at = std::min(2 * i + k / 2, height - 1) * stride + std::min(2 * j + k % 2, width - 1);
+                u_sum += u[at];
+                v_sum += v[at];
+            }
+            u420[i * chroma_width + j] = uv[i * chroma_width * 2 + j * 2] = static_cast<uint8_t>(u_sum / 4);
+            v420[i * chroma_width + j] = uv[i * chroma_width * 2 + j * 2 + 1] = static_cast<uint8_t>(v_sum / 4);
+        }
+    }
+
+    const Jpeg_yuv_planes yuv444{.width = width,
+                                 .height = height,
+                                 .layout = Jpeg_yuv_layout::yuv444,
+                                 .y = y.data(),
+                                 .y_stride = stride,
+                                 .u = u.data(),
+                                 .u_stride = stride,
+                                 .v = v.data(),
+                                 .v_stride = stride};
+    auto i420 = yuv444;
+    i420.layout = Jpeg_yuv_layout::i420;
+    i420.u = u420.data();
+    i420.u_stride = chroma_width;
+    i420.v = v420.data();
+    i420.v_stride = chroma_width;
+    auto nv12 = i420;
+    nv12.layout = Jpeg_yuv_layout::nv12;
+    nv12.u = uv.data();
+    nv12.u_stride = chroma_width * 2;
+    nv12.v = nullptr;
+
+    for (const auto& options : {Jpeg_options{}, Jpeg_options{.huffman = Jpeg_huffman::standard},
+                                Jpeg_options{.restart_rows = 1, .threads = 2},
+                                Jpeg_options{.scans = Jpeg_scan::default_script()}}) {
+        const auto expected420 = toVector(Jpeg<Jpeg_sampling::ds_4_2_0>::write(image, options));
+        EXPECT_EQ(toVector(Jpeg<Jpeg_sampling::ds_4_2_0>::write_yuv(i420, options)), expected420);
+        EXPECT_EQ(toVector(Jpeg<Jpeg_sampling::ds_4_2_0>::write_yuv(nv12, options)), expected420);
+        EXPECT_EQ(toVector(Jpeg<Jpeg_sampling::ds_4_4_4>::write_yuv(yuv444, options)),
+                  toVector(Jpeg<Jpeg_sampling::ds_4_4_4>::write(image, options)));
+    }
+    EXPECT_EQ(toVector(Jpeg<Jpeg_sampling::grayscale>::write_yuv(nv12)),
+              toVector(Jpeg<Jpeg_sampling::grayscale>::write(image)));
+    Jpeg_encoder<> encoder;
+    EXPECT_EQ(toVector(encoder.encode(i420)), toVector(Jpeg<>::write(image)));
+
+    EXPECT_THROW(Jpeg<Jpeg_sampling::ds_4_4_4>::write_yuv(i420), std::invalid_argument);
+    EXPECT_THROW(Jpeg<Jpeg_sampling::ds_4_2_0>::write_yuv(yuv444), std::invalid_argument);
+    EXPECT_THROW(Jpeg<Jpeg_sampling::ds_4_2_2>::write_yuv(i420), std::invalid_argument);
+    auto missing = i420;
+    missing.v = nullptr;
+    EXPECT_THROW(Jpeg<>::write_yuv(missing), std::invalid_argument);
+}
+
+TEST(JpegEncoderTest, RejectsProgressive) {
+    Jpeg_encoder<> encoder;
+    EXPECT_THROW(encoder.encode(makeImage(16, 16), {.scans = Jpeg_scan::default_script()}), std::invalid_argument);
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,194 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <random>
+#include <vector>
+
+#include "jpeg_bit_writer.hpp"
+#include "jpeg_huffman.hpp"
+
+using namespace f9ay;
+
+TEST(JpegHuffmanTest, StandardTablesMatchAnnexK) {
+    const auto& tables = Jpeg_huffman_tables::standard();
+
+    // a few codes listed in ITU T.81 Table K.3 - K.6
+    EXPECT_EQ(tables.y_dc.getMapping(0).value, 0b00);
+    EXPECT_EQ(tables.y_dc.getMapping(0).length, 2);
+    EXPECT_EQ(tables.y_dc.getMapping(11).value, 0b111111110);
+    EXPECT_EQ(tables.y_dc.getMapping(11).length, 9);
+    EXPECT_EQ(tables.uv_dc.getMapping(11).value, 0b11111111110);
+    EXPECT_EQ(tables.uv_dc.getMapping(11).length, 11);
+
+    EXPECT_EQ(tables.y_ac.getMapping(0x00).value, 0b1010);  // EOB
+    EXPECT_EQ(tables.y_ac.getMapping(0x00).length, 4);
+    EXPECT_EQ(tables.y_ac.getMapping(0xF0).value, 0b11111111001);  // ZRL
+    EXPECT_EQ(tables.y_ac.getMapping(0xF0).length, 11);
+    EXPECT_EQ(tables.y_ac.getMapping(0xFA).value, 0xFFFE);
+    EXPECT_EQ(tables.y_ac.getMapping(0xFA).length, 16);
+
+    EXPECT_EQ(tables.uv_ac.getMapping(0x00).value, 0b00);  // EOB
+    EXPECT_EQ(tables.uv_ac.getMapping(0x00).length, 2);
+    EXPECT_EQ(tables.uv_ac.getMapping(0xF0).value, 0b1111111010);  // ZRL
+    EXPECT_EQ(tables.uv_ac.getMapping(0xF0).length, 10);
+}
+
+TEST(JpegHuffmanTest, FromFrequenciesBuildsCanonicalCodes) {
+    std::mt19937 rng(3);
+    std::geometric_distribution<int> dist(0.05);
+
+    std::array<uint32_t, 256> counts{};
+    for (int i = 0; i < 10000; i++) {
+        counts[std::min(dist(rng), 255)]++;
+    }
+    const auto table = Jpeg_huffman_table::from_frequencies(counts);
+    const auto used = std::ranges::count_if(counts, [](uint32_t count) { return count > 0; });
+    ASSERT_EQ(table.symbols().size(), static_cast<std::size_t>(used));
+
+    // Annex C: codes follow the order of values, each one is the previous code plus one, shifted to its length
+    uint32_t expected = 0;
+    int previous_length = 0;
+    for (const auto symbol : table.symbols()) {
+        const auto code = table.getMapping(symbol);
+        ASSERT_GE(code.length, previous_length) << "symbol: " << int{symbol};
+        ASSERT_LE(code.length, 16) << "symbol: " << int{symbol};
+        expected <<= code.length - previous_length;
+        EXPECT_EQ(code.value, expected) << "symbol: " << int{symbol};
+        expected++;
+        previous_length = code.length;
+    }
+    // a more frequent symbol never gets a longer code
+    for (const auto x : table.symbols()) {
+        for (const auto y : table.symbols()) {
+            if (counts[x] > counts[y]) {
+                EXPECT_LE(table.getMapping(x).length, table.getMapping(y).length) << int{x} << " vs " << int{y};
+            }
+        }
+    }
+}
+
+TEST(JpegHuffmanTest, FromFrequenciesLimitsCodeLength) {
+    // fibonacci frequencies would need codes much longer than 16 bits
+    std::array<uint32_t, 256> counts{};
+    uint32_t a = 1, b = 2;
+    for (int i = 0; i < 30; i++) {
+        counts[i * 3] = a;
+        b = a + b;
+        a = b - a;
+    }
+    const auto table = Jpeg_huffman_table::from_frequencies(counts);
+    ASSERT_EQ(table.symbols().size(), 30u);
+
+    // Kraft sum must stay below 1 so that no code is all ones
+    uint64_t kraft = 0;
+    for (int len = 1; len <= 16; len++) {
+        kraft += static_cast<uint64_t>(table.bits[len - 1]) << (16 - len);
+    }
+    EXPECT_LT(kraft, 1u << 16);
+    for (int i = 0; i < 30; i++) {
+        const auto code = table.getMapping(i * 3);
+        ASSERT_GT(code.length, 0) << "symbol: " << i * 3;
+        ASSERT_LE(code.length, 16) << "symbol: " << i * 3;
+        EXPECT_NE(code.value, (1u << code.length) - 1) << "symbol: " << i * 3;
+    }
+    // more frequent symbols never get longer codes
+    for (int i = 1; i < 30; i++) {
+        EXPECT_LE(table.getMapping(i * 3).length, table.getMapping((i - 1) * 3).length);
+    }
+
+    EXPECT_TRUE(Jpeg_huffman_table::from_frequencies({}).symbols().empty());
+}
+
+TEST(JpegHuffmanTest, FromFrequenciesHandlesCodesLongerThan32Bits) {
+    // 45 fibonacci frequencies still fit in uint32_t, but the unlimited tree is about 45 levels deep
+    std::array<uint32_t, 256> counts{};
+    uint32_t a = 1, b = 1;
+    for (int i = 0; i < 45; i++) {
+        counts[255 - i] = a;
+        b = a + b;
+        a = b - a;
+    }
+    const auto table = Jpeg_huffman_table::from_frequencies(counts);
+    ASSERT_EQ(table.symbols().size(), 45u);
+
+    uint64_t kraft = 0;
+    for (int len = 1; len <= 16; len++) {
+        kraft += static_cast<uint64_t>(table.bits[len - 1]) << (16 - len);
+    }
+    EXPECT_LT(kraft, 1u << 16);
+    for (int i = 0; i < 45; i++) {
+        const auto code = table.getMapping(255 - i);
+        ASSERT_GT(code.length, 0) << "symbol: " << 255 - i;
+        ASSERT_LE(code.length, 16) << "symbol: " << 255 - i;
+    }
+}
+
+TEST(JpegHuffmanTest, CoverAllSymbolsGivesEveryBaselineSymbolACode) {
+    Jpeg_huffman_frequencies frequencies;
+    frequencies.y_dc[3] = 5000;
+    frequencies.y_ac[0x01] = 100000;
+    frequencies.y_ac[0x00] = 20000;
+    frequencies.cover_all_symbols(false);
+    const auto tables = Jpeg_huffman_tables::from_frequencies(frequencies);
+
+    for (int category = 0; category <= 11; category++) {
+        EXPECT_GT(tables.y_dc.getMapping(category).length, 0) << "category: " << category;
+    }
+    for (int symbol : {0x00, 0xF0}) {
+        EXPECT_GT(tables.y_ac.getMapping(symbol).length, 0) << "symbol: " << symbol;
+    }
+    for (int run = 0; run < 16; run++) {
+        for (int size = 1; size <= 10; size++) {
+            const auto length = tables.y_ac.getMapping(run << 4 | size).length;
+            EXPECT_GT(length, 0) << "run: " << run << ", size: " << size;
+            EXPECT_LE(length, 16);
+        }
+    }
+    // the most frequent symbol still gets the shortest code
+    EXPECT_LE(tables.y_ac.getMapping(0x01).length, tables.y_ac.getMapping(0x00).length);
+    // chroma was not requested, so its tables stay empty
+    EXPECT_EQ(tables.uv_dc.symbols().size(), 0u);
+}
+
+TEST(JpegHuffmanTest, BitWriterMatchesBitByBit) {
+    std::mt19937 rng(9);
+    std::uniform_int_distribution<int> countDist(0, 32);
+
+    for (int round = 0; round < 100; round++) {
+        std::vector<std::byte> out;
+        Jpeg_bit_writer writer(out);
+        std::vector<bool> bits;
+        for (int i = 0; i < 500; i++) {
+            const int count = countDist(rng);
+            // bias towards all ones so 0xFF bytes show up often
+            const uint32_t value = (rng() % 4 == 0 ? rng() : 0xFFFFFFFFu) & (count == 32 ? ~0u : (1u << count) - 1);
+            writer.write(value, count);
+            for (int b = count - 1; b >= 0; b--) {
+                bits.push_back((value >> b) & 1);
+            }
+        }
+        writer.flush();
+        while (bits.size() % 8 != 0) {
+            bits.push_back(true);
+        }
+
+        std::vector<std::byte> expected;
+        for (std::size_t i = 0; i < bits.size(); i += 8) {
+            uint8_t byte = 0;
+            for (int b = 0; b < 8; b++) {
+                byte = byte << 1 | bits[i + b];
+            }
+            expected.push_back(std::byte{byte});
+            if (byte == 0xFF) {
+                expected.push_back(std::byte{0});
+            }
+        }
+        ASSERT_EQ(out, expected) << "Round: " << round;
+    }
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "jpeg_progressive.hpp"
+
+using namespace f9ay;
+
+namespace {
+// 把 symbol 跟 bit 記成字串, 方便比對
+struct Recording_sink {
+    std::vector<std::string> out;
+
+    void symbol(int table, uint8_t value) {
+        out.push_back("S" + std::to_string(table) + ":" + std::to_string(value));
+    }
+
+    void bits(uint32_t value, int count) {
+        out.push_back("b" + std::to_string(value) + "/" + std::to_string(count));
+    }
+};
+}  // namespace
+
+TEST(JpegProgressiveTest, ValidatesScanScript) {
+    EXPECT_NO_THROW(Jpeg_scan::validate_script(Jpeg_scan::default_script()));
+    EXPECT_NO_THROW(Jpeg_scan::validate_script({{{0, 1, 2}, 0, 0, 0, 0}}));
+
+    // AC scan 只能有一個 component
+    EXPECT_THROW(Jpeg_scan::validate_script({{{0, 1, 2}, 0, 0, 0, 0}, {{0, 1}, 1, 63, 0, 0}}), std::invalid_argument);
+    // AC 不能比 DC 先送
+    EXPECT_THROW(Jpeg_scan::validate_script({{{0}, 1, 63, 0, 0}, {{0, 1, 2}, 0, 0, 0, 0}}), std::invalid_argument);
+    // refine 一定要接在上一次送到的 bit 後面
+    EXPECT_THROW(Jpeg_scan::validate_script({{{0, 1, 2}, 0, 0, 0, 2}, {{0, 1, 2}, 0, 0, 1, 0}}),
+                 std::invalid_argument);
+    // 同一個頻段不能送兩次
+    EXPECT_THROW(Jpeg_scan::validate_script({{{0, 1, 2}, 0, 0, 0, 0}, {{1}, 1, 5, 0, 0}, {{1}, 5, 63, 0, 0}}),
+                 std::invalid_argument);
+    // Cr 沒有 DC
+    EXPECT_THROW(Jpeg_scan::validate_script({{{0, 1}, 0, 0, 0, 0}}), std::invalid_argument);
+
+    // 灰階只有 component 0
+    EXPECT_NO_THROW(Jpeg_scan::validate_script(Jpeg_scan::default_script(1), 1));
+    EXPECT_THROW(Jpeg_scan::validate_script(Jpeg_scan::default_script(), 1), std::invalid_argument);
+}
+
+TEST(JpegProgressiveTest, AcFirstMergesEndOfBlocks) {
+    const Jpeg_scan scan{{1}, 1, 63, 0, 1};
+    Recording_sink sink;
+    Jpeg_scan_encoder encoder(scan, sink);
+
+    std::array<int, 64> block{};
+    block[1] = 10;  // >> 1 = 5
+    block[3] = -5;  // >> 1 = -2
+    block[4] = 1;   // >> 1 = 0
+    const std::array<int, 64> zero{};
+    encoder.encode(1, block);
+    encoder.encode(1, zero);
+    encoder.encode(1, zero);
+    encoder.encode(1, block);
+    encoder.finish();
+
+    const std::vector<std::string> expected = {
+        "S1:3",  "b5/3", "S1:18", "b1/2",          // 第一個 block
+        "S1:16", "b1/1",                           // EOBRUN = 3
+        "S1:3",  "b5/3", "S1:18", "b1/2", "S1:0",  // 最後一個 block 跟它的 EOB
+    };
+    EXPECT_EQ(sink.out, expected);
+}
+
+TEST(JpegProgressiveTest, AcRefineDefersCorrectionBits) {
+    const Jpeg_scan scan{{0}, 1, 63, 1, 0};
+    Recording_sink sink;
+    Jpeg_scan_encoder encoder(scan, sink);
+
+    std::array<int, 64> old_only{};
+    old_only[1] = 3;  // 之前已經送過, 這次只送 correction bit 1
+    std::array<int, 64> with_new{};
+    with_new[2] = -2;  // correction bit 0
+    with_new[5] = -1;  // 新的係數
+    encoder.encode(0, old_only);
+    encoder.encode(0, with_new);
+    encoder.finish();
+
+    const std::vector<std::string> expected = {
+        "S0:0", "b1/1",           // 第一個 block 整個是 EOBRUN, 它的 correction bit 接在後面
+        "S0:49", "b0/1", "b0/1",  // run 3 (不算之前非 0 的係數) 接新的 -1, 再補 with_new[2] 的 correction bit
+        "S0:0",
+    };
+    EXPECT_EQ(sink.out, expected);
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
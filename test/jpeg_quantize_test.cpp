@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cmath>
+#include <random>
+
+#include "jpeg_quantize.hpp"
+
+using namespace f9ay;
+
+TEST(JpegQuantizeTest, QualityScalingMatchesLibjpeg) {
+    // quality 50 is the Annex K table itself
+    EXPECT_EQ(Jpeg_quant_tables::get(50).luma.matrix, Jpeg_quant_tables::annex_k_luma);
+    EXPECT_EQ(Jpeg_quant_tables::get(50).chroma.matrix, Jpeg_quant_tables::annex_k_chroma);
+
+    // first rows of libjpeg's quality 75 and quality 10 tables
+    EXPECT_EQ(Jpeg_quant_tables::get(75).luma.matrix[0], (std::array<uint8_t, 8>{8, 6, 5, 8, 12, 20, 26, 31}));
+    EXPECT_EQ(Jpeg_quant_tables::get(75).chroma.matrix[0], (std::array<uint8_t, 8>{9, 9, 12, 24, 50, 50, 50, 50}));
+    EXPECT_EQ(Jpeg_quant_tables::get(10).luma.matrix[0],
+              (std::array<uint8_t, 8>{80, 55, 50, 80, 120, 200, 255, 255}));
+
+    for (const auto& row : Jpeg_quant_tables::get(100).luma.matrix) {
+        for (auto q : row) {
+            EXPECT_EQ(q, 1);
+        }
+    }
+
+    EXPECT_THROW(Jpeg_quant_tables::get(101), std::invalid_argument);
+    EXPECT_THROW(Jpeg_quant_tables::get(-1), std::invalid_argument);
+}
+
+TEST(JpegQuantizeTest, ReciprocalMatchesDivision) {
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> dist(-2048, 2047);
+
+    for (int quality : {0, 1, 10, 50, 75, 95, 100}) {
+        for (const auto* table : {&Jpeg_quant_tables::get(quality).luma, &Jpeg_quant_tables::get(quality).chroma}) {
+            for (int round = 0; round < 200; round++) {
+                std::array<int, 64> block;
+                for (auto& x : block) {
+                    x = dist(rng);
+                }
+                auto quantized = block;
+                table->quantize(quantized);
+
+                for (int i = 0; i < 64; i++) {
+                    const int q = table->matrix[i / 8][i % 8];
+                    ASSERT_EQ(quantized[i], std::round(block[i] / float(q)))
+                        << "quality: " << quality << ", x: " << block[i] << ", q: " << q;
+                }
+            }
+        }
+    }
+}
+
+TEST(JpegQuantizeTest, ReciprocalHandlesTies) {
+    // x / q lands exactly on .5 for even q, it must round away from zero
+    const auto& table = Jpeg_quant_tables::get(50).luma;  // luma[0][0] = 16
+    std::array<int, 64> block{};
+    block[0] = 24;
+    table.quantize(block);
+    EXPECT_EQ(block[0], 2);
+
+    block = {};
+    block[0] = -24;
+    table.quantize(block);
+    EXPECT_EQ(block[0], -2);
+}
+
+TEST(JpegQuantizeTest, ZigzagKernelMatchesQuantizeThenReorder) {
+    // T.81 Figure A.6
+    constexpr std::array<uint8_t, 64> expected_order = {
+        0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,  12, 19, 26, 33, 40, 48,
+        41, 34, 27, 20, 13, 6,  7,  14, 21, 28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23,
+        30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+    };
+    static_assert(jpeg_natural_order == expected_order);
+    // the fused table can be built at compile time
+    constexpr Jpeg_quant_table constant_table(Jpeg_quant_tables::annex_k_luma);
+    static_assert(constant_table.matrix[7][7] == 99);
+
+    std::mt19937 rng(21);
+    std::uniform_int_distribution<int> dist(-2048, 2047);
+    for (int quality : {0, 10, 75, 100}) {
+        const auto& table = Jpeg_quant_tables::get(quality).chroma;
+        for (int round = 0; round < 100; round++) {
+            std::array<int, 64> block;
+            for (auto& x : block) {
+                x = dist(rng);
+            }
+            auto natural = block;
+            table.quantize(natural);
+            std::array<int, 64> zigzag;
+            table.quantize_zigzag(block, zigzag);
+            auto natural_aan = block;
+            table.quantize_aan(natural_aan);
+            std::array<int, 64> zigzag_aan;
+            table.quantize_aan_zigzag(block, zigzag_aan);
+            for (int k = 0; k < 64; k++) {
+                const int n = jpeg_natural_order[k];
+                const int q = table.matrix[n / 8][n % 8];
+                ASSERT_EQ(zigzag[k], std::round(block[n] / float(q))) << "quality: " << quality << ", k: " << k;
+                ASSERT_EQ(zigzag[k], natural[n]);
+                ASSERT_EQ(zigzag_aan[k], natural_aan[n]);
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <vector>
+
+#include "jpeg.hpp"
+
+using namespace f9ay;
+
+namespace {
+Matrix<colors::BGR> makeImage(int height, int width) {
+    Matrix<colors::BGR> image(height, width);
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            image[i, j] = {static_cast<uint8_t>(j * 255 / width), static_cast<uint8_t>(i * 255 / height),
+                           static_cast<uint8_t>((i / 5 + j / 3) % 2 == 0 ? 60 : 180)};
+        }
+    }
+    return image;
+}
+
+Matrix<colors::BGR> decode(const std::pair<std::unique_ptr<std::byte[]>, size_t>& jpeg) {
+    return std::get<Matrix<colors::BGR>>(Jpeg<>::importFromByte(jpeg.first.get(), jpeg.second));
+}
+
+// 轉換後的 (i, j) 在原圖上的位置, width / height 是轉置後裁切前的大小
+std::pair<int, int> sourcePixel(Jpeg_transform transform, int i, int j, int width, int height) {
+    const auto steps = Jpeg_transformer::steps(transform);
+    if (steps.flip_x) {
+        j = width - 1 - j;
+    }
+    if (steps.flip_y) {
+        i = height - 1 - i;
+    }
+    return steps.transpose ? std::pair{j, i} : std::pair{i, j};
+}
+}  // namespace
+
+TEST(JpegTransformTest, MatchesPixelTransform) {
+    // 寬高都是 MCU 的倍數, 不會被裁掉
+    const auto image = makeImage(48, 64);
+    const auto jpeg = Jpeg<Jpeg_sampling::ds_4_2_0>::write(image, {.quality = 90});
+    const auto original = decode(jpeg);
+
+    for (const auto transform :
+         {Jpeg_transform::flip_horizontal, Jpeg_transform::flip_vertical, Jpeg_transform::transpose,
+          Jpeg_transform::transverse, Jpeg_transform::rotate_90, Jpeg_transform::rotate_180,
+          Jpeg_transform::rotate_270}) {
+        const auto transposed = Jpeg_transformer::steps(transform).transpose;
+        const auto result = decode(Jpeg<>::transform(jpeg.first.get(), jpeg.second, {.transform = transform}));
+        ASSERT_EQ(result.row(), transposed ? 64 : 48);
+        ASSERT_EQ(result.col(), transposed ? 48 : 64);
+        for (int i = 0; i < result.row(); i++) {
+            for (int j = 0; j < result.col(); j++) {
+                const auto [si, sj] = sourcePixel(transform, i, j, result.col(), result.row());
+                // 係數一樣, 只有 IDCT 先算行或先算列造成的捨入差
+                ASSERT_LE(std::abs(result[i, j].g - original[si, sj].g), 3)
+                    << "transform: " << static_cast<int>(transform) << ", i: " << i << ", j: " << j;
+            }
+        }
+    }
+}
+
+TEST(JpegTransformTest, RotationsAreLossless) {
+    const auto image = makeImage(32, 48);
+    const auto jpeg = Jpeg<Jpeg_sampling::ds_4_2_0>::write(image);
+    const auto coefficients = Jpeg_decoder::read_coefficients(jpeg.first.get(), jpeg.second);
+
+    const auto rotated = Jpeg_transformer::apply(coefficients, {.transform = Jpeg_transform::rotate_90});
+    EXPECT_EQ(rotated.components[0].h, 2);
+    const auto back = Jpeg_transformer::apply(rotated, {.transform = Jpeg_transform::rotate_270});
+    ASSERT_EQ(back.components.size(), coefficients.components.size());
+    for (std::size_t c = 0; c < back.components.size(); c++) {
+        EXPECT_EQ(back.components[c].blocks, coefficients.components[c].blocks) << "component: " << c;
+    }
+    EXPECT_EQ(back.quant_tables, coefficients.quant_tables);
+
+    // 重新熵編碼後讀回來的係數不變
+    const auto encoded = Jpeg_transformer::encode(rotated);
+    const auto reread = Jpeg_decoder::read_coefficients(encoded.first.get(), encoded.second);
+    for (std::size_t c = 0; c < reread.components.size(); c++) {
+        EXPECT_EQ(reread.components[c].blocks, rotated.components[c].blocks) << "component: " << c;
+    }
+}
+
+TEST(JpegTransformTest, TrimsAndCrops) {
+    const auto jpeg = Jpeg<Jpeg_sampling::ds_4_2_0>::write(makeImage(45, 61));
+    const auto* data = jpeg.first.get();
+
+    // 鏡像的方向捨去不滿一個 MCU 的部分
+    const auto flipped = decode(Jpeg<>::transform(data, jpeg.second, {.transform = Jpeg_transform::flip_horizontal}));
+    EXPECT_EQ(flipped.row(), 45);
+    EXPECT_EQ(flipped.col(), 48);
+
+    const auto cropped = decode(Jpeg<>::transform(data, jpeg.second, {.crop_x = 16, .crop_y = 32, .crop_width = 20}));
+    EXPECT_EQ(cropped.row(), 13);
+    EXPECT_EQ(cropped.col(), 20);
+
+    EXPECT_THROW(Jpeg<>::transform(data, jpeg.second, {.crop_x = 8}), std::invalid_argument);
+    EXPECT_THROW(Jpeg<>::transform(data, jpeg.second, {.crop_y = 48}), std::invalid_argument);
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}